@@ -0,0 +1,340 @@
+// Times the hot math and intersection kernels in isolation. Every kernel runs over the same randomized batch
+// a number of times and the fastest run is reported, in TSC cycles and nanoseconds per element.
+// SSE variants are candidates for the renderer and are only measured here. Results are folded into a checksum
+// that gets printed, so the compiler can't drop the work.
+
+#include "color.h"
+#include "random.h"
+#include "ray.h"
+#include "shapes.h"
+#include "system.h"
+#include "vec.h"
+
+#ifdef AE_PLATFORM_WIN32
+#include "common_win32.h"
+#include <intrin.h>
+#elif defined(AE_PLATFORM_LINUX)
+#include "common_linux.h"
+#include <x86intrin.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <emmintrin.h>
+#include <vector>
+
+namespace {
+    constexpr u32 batch_size = 1 << 16; // Multiple of 4 for the SSE variants
+    constexpr u32 repeats = 25;
+
+    struct batch {
+        std::vector<ae::vec4f> origins;
+        std::vector<ae::vec4f> directions;
+        std::vector<ae::color> colors;
+        std::vector<ae::hsv> hsvs;
+        std::vector<f32> factors;
+    };
+
+    // Keeps a value alive without storing it anywhere
+    template<typename TType>
+    AE_FORCEINLINE void keep(const TType &value) {
+#ifdef AE_PLATFORM_WIN32
+        static volatile TType sink;
+        sink = value;
+#elif defined(AE_PLATFORM_LINUX)
+        asm volatile("" : : "g"(&value) : "memory");
+#endif
+    }
+
+    batch make_batch() {
+        ae::random rng(0x5eed);
+        batch result;
+
+        auto next = [&rng](f32 min, f32 max) {
+            return min + (max - min) * rng.next_f32();
+        };
+
+        for(u32 i = 0; i < batch_size; i++) {
+            result.origins.emplace_back(next(-1.0f, 1.0f), next(-1.0f, 1.0f), next(0.5f, 2.0f));
+            result.directions.emplace_back(next(-0.5f, 0.5f), next(-0.5f, 0.5f), -1.0f);
+            result.colors.emplace_back(next(0.0f, 1.0f), next(0.0f, 1.0f), next(0.0f, 1.0f));
+            result.hsvs.push_back({ .h_ = next(0.0f, 360.0f), .s_ = next(0.0f, 1.0f), .v_ = next(0.0f, 1.0f), .a_ = 1.0f });
+            result.factors.push_back(next(0.0f, 1.0f));
+        }
+
+        return result;
+    }
+
+    // Runs kernel repeats times and prints the fastest run. kernel returns a checksum of its results.
+    template<typename TKernel>
+    void run(const char *name, const char *variant, TKernel kernel) {
+        u64 best_cycles = static_cast<u64>(-1);
+        u64 best_ns = static_cast<u64>(-1);
+        u64 checksum = 0;
+
+        for(u32 i = 0; i < repeats; i++) {
+            const u64 start_ns = ae::system_time_ns();
+            const u64 start_cycles = __rdtsc();
+
+            checksum = kernel();
+            keep(checksum);
+
+            const u64 cycles = __rdtsc() - start_cycles;
+            const u64 ns = ae::system_time_ns() - start_ns;
+
+            best_cycles = (cycles < best_cycles) ? cycles : best_cycles;
+            best_ns = (ns < best_ns) ? ns : best_ns;
+        }
+
+        std::printf("%-24s %-8s %10.2f %10.3f   %016llx\n",
+                    name,
+                    variant,
+                    static_cast<f64>(best_cycles) / batch_size,
+                    static_cast<f64>(best_ns) / batch_size,
+                    static_cast<unsigned long long>(checksum));
+    }
+
+    u64 checksum_f32(u64 checksum, f32 value) {
+        u32 bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        return (checksum ^ bits) * 0x100000001b3ull;
+    }
+
+    // Four rays against one sphere, with one register per component of the origins and directions
+    __m128 intersect_sphere_x4(__m128 ox, __m128 oy, __m128 oz,
+                               __m128 dx, __m128 dy, __m128 dz,
+                               const ae::sphere &sphere) {
+        const __m128 ocx = _mm_sub_ps(_mm_set1_ps(sphere.center_.x_), ox);
+        const __m128 ocy = _mm_sub_ps(_mm_set1_ps(sphere.center_.y_), oy);
+        const __m128 ocz = _mm_sub_ps(_mm_set1_ps(sphere.center_.z_), oz);
+
+        const __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        const __m128 half_b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ocx), _mm_mul_ps(dy, ocy)), _mm_mul_ps(dz, ocz));
+        const __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)),
+                                    _mm_set1_ps(sphere.radius_ * sphere.radius_));
+
+        // Same quadric as ae::sphere::intersects with b = -2 * half_b, misses come out as 0
+        const __m128 discriminant = _mm_sub_ps(_mm_mul_ps(half_b, half_b), _mm_mul_ps(a, c));
+        const __m128 hit = _mm_cmpge_ps(discriminant, _mm_setzero_ps());
+        const __m128 t = _mm_div_ps(_mm_sub_ps(half_b, _mm_sqrt_ps(_mm_max_ps(discriminant, _mm_setzero_ps()))), a);
+
+        return _mm_and_ps(hit, t);
+    }
+
+    void bench_vec4(const batch &data) {
+        run("vec4 dot3", "scalar", [&data]() {
+            f32 sum = 0.0f;
+
+            for(u32 i = 0; i < batch_size; i++) {
+                sum += data.origins[i].dot3(data.directions[i]);
+            }
+
+            return checksum_f32(0, sum);
+        });
+
+        run("vec4 dot3", "sse", [&data]() {
+            __m128 sum = _mm_setzero_ps();
+
+            for(u32 i = 0; i < batch_size; i++) {
+                const __m128 product = _mm_mul_ps(_mm_load_ps(data.origins[i].v_), _mm_load_ps(data.directions[i].v_));
+                const __m128 y = _mm_shuffle_ps(product, product, _MM_SHUFFLE(1, 1, 1, 1));
+                const __m128 z = _mm_shuffle_ps(product, product, _MM_SHUFFLE(2, 2, 2, 2));
+                sum = _mm_add_ss(sum, _mm_add_ss(_mm_add_ss(product, y), z));
+            }
+
+            return checksum_f32(0, _mm_cvtss_f32(sum));
+        });
+
+        run("vec4 normalize", "scalar", [&data]() {
+            ae::vec4f sum;
+
+            for(u32 i = 0; i < batch_size; i++) {
+                sum += data.directions[i].get_normalized();
+            }
+
+            return checksum_f32(checksum_f32(checksum_f32(0, sum.x_), sum.y_), sum.z_);
+        });
+
+        run("vec4 normalize", "sse", [&data]() {
+            __m128 sum = _mm_setzero_ps();
+
+            for(u32 i = 0; i < batch_size; i++) {
+                const __m128 v = _mm_load_ps(data.directions[i].v_);
+                __m128 squared = _mm_mul_ps(v, v);
+                squared = _mm_add_ps(squared, _mm_shuffle_ps(squared, squared, _MM_SHUFFLE(2, 3, 0, 1)));
+                squared = _mm_add_ps(squared, _mm_shuffle_ps(squared, squared, _MM_SHUFFLE(1, 0, 3, 2)));
+                sum = _mm_add_ps(sum, _mm_div_ps(v, _mm_sqrt_ps(squared)));
+            }
+
+            alignas(16) f32 lanes[4];
+            _mm_store_ps(lanes, sum);
+
+            return checksum_f32(checksum_f32(checksum_f32(0, lanes[0]), lanes[1]), lanes[2]);
+        });
+    }
+
+    void bench_ray(const batch &data) {
+        run("ray construction", "scalar", [&data]() {
+            ae::vec4f sum;
+
+            for(u32 i = 0; i < batch_size; i++) {
+                const ae::ray ray(data.origins[i], data.directions[i]);
+                sum += ray.direction();
+            }
+
+            return checksum_f32(checksum_f32(checksum_f32(0, sum.x_), sum.y_), sum.z_);
+        });
+    }
+
+    void bench_sphere(const batch &data) {
+        const ae::sphere sphere(ae::vec4f(0.0f, 0.0f, -2.0f), 1.0f);
+
+        // The rays are built up front, so only the intersection is timed
+        std::vector<ae::ray> rays;
+        std::vector<f32> soa(static_cast<size_t>(batch_size) * 6);
+
+        for(u32 i = 0; i < batch_size; i++) {
+            rays.emplace_back(data.origins[i], data.directions[i]);
+
+            for(u32 axis = 0; axis < 3; axis++) {
+                soa[axis * batch_size + i] = rays.back().origin().v_[axis];
+                soa[(axis + 3) * batch_size + i] = rays.back().direction().v_[axis];
+            }
+        }
+
+        run("sphere::intersects", "scalar", [&sphere, &rays]() {
+            u32 hits = 0;
+            f32 t_sum = 0.0f;
+
+            for(const ae::ray &ray : rays) {
+                ae::ray_hit_info info;
+
+                if(sphere.intersects(ray, info)) {
+                    hits++;
+                    t_sum += info.t_;
+                }
+            }
+
+            return checksum_f32(hits, t_sum);
+        });
+
+        // Only the distance, the scalar kernel also computes the hit point and normal
+        run("sphere::intersects", "sse x4", [&sphere, &soa]() {
+            u32 hits = 0;
+            __m128 t_sum = _mm_setzero_ps();
+
+            for(u32 i = 0; i < batch_size; i += 4) {
+                const __m128 t = intersect_sphere_x4(_mm_loadu_ps(&soa[0 * batch_size + i]),
+                                                     _mm_loadu_ps(&soa[1 * batch_size + i]),
+                                                     _mm_loadu_ps(&soa[2 * batch_size + i]),
+                                                     _mm_loadu_ps(&soa[3 * batch_size + i]),
+                                                     _mm_loadu_ps(&soa[4 * batch_size + i]),
+                                                     _mm_loadu_ps(&soa[5 * batch_size + i]),
+                                                     sphere);
+
+                const u32 mask = static_cast<u32>(_mm_movemask_ps(_mm_cmpneq_ps(t, _mm_setzero_ps())));
+                hits += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + (mask >> 3);
+                t_sum = _mm_add_ps(t_sum, t);
+            }
+
+            alignas(16) f32 lanes[4];
+            _mm_store_ps(lanes, t_sum);
+
+            return checksum_f32(hits, (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]));
+        });
+    }
+
+    void bench_color(const batch &data) {
+        run("color::get_argb32", "scalar", [&data]() {
+            u64 sum = 0;
+
+            for(const ae::color &color : data.colors) {
+                sum += color.get_argb32();
+            }
+
+            return sum;
+        });
+
+        // ae::color is stored as [a r g b], so a single conversion and two packs give the argb bytes
+        run("color::get_argb32", "sse", [&data]() {
+            static_assert(sizeof(ae::color) == 16);
+
+            const __m128 scale = _mm_set1_ps(255.0f);
+            u64 sum = 0;
+
+            for(const ae::color &color : data.colors) {
+                const __m128i channels = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(&color.a_), scale));
+                const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(channels, channels), channels);
+                const u32 packed = static_cast<u32>(_mm_cvtsi128_si32(bytes)); // a in the lowest byte
+
+                sum += (packed << 24) | ((packed & 0xff00) << 8) | ((packed >> 8) & 0xff00) | (packed >> 24);
+            }
+
+            return sum;
+        });
+
+        run("hsv::lerp", "scalar", [&data]() {
+            f32 sum = 0.0f;
+
+            for(u32 i = 0; i + 1 < batch_size; i++) {
+                const ae::hsv result = data.hsvs[i].lerp(data.hsvs[i + 1], data.factors[i]);
+                sum += result.h_ + result.s_ + result.v_;
+            }
+
+            return checksum_f32(0, sum);
+        });
+    }
+
+    void bench_random() {
+        run("random::next_f32", "scalar", []() {
+            ae::random rng(0x5eed);
+            f32 sum = 0.0f;
+
+            for(u32 i = 0; i < batch_size; i++) {
+                sum += rng.next_f32();
+            }
+
+            return checksum_f32(0, sum);
+        });
+
+        // Four independent xorshift streams, converted in single precision
+        run("random::next_f32", "sse x4", []() {
+            __m128i state = _mm_set_epi32(0x5eed, 0x9e3779b9, 0x85ebca6b, 0xc2b2ae35);
+            const __m128 scale = _mm_set1_ps(1.0f / 4294967296.0f);
+            const __m128i bias = _mm_set1_epi32(static_cast<i32>(0x80000000u));
+            __m128 sum = _mm_setzero_ps();
+
+            for(u32 i = 0; i < batch_size; i += 4) {
+                state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+                state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+                state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+
+                // cvtepi32 is signed, so the values get shifted into its range and back
+                const __m128 value = _mm_add_ps(_mm_cvtepi32_ps(_mm_xor_si128(state, bias)), _mm_set1_ps(2147483648.0f));
+                sum = _mm_add_ps(sum, _mm_mul_ps(value, scale));
+            }
+
+            alignas(16) f32 lanes[4];
+            _mm_store_ps(lanes, sum);
+
+            return checksum_f32(0, (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]));
+        });
+    }
+}
+
+int main() {
+    ae::system_init();
+
+    const batch data = make_batch();
+
+    std::printf("%-24s %-8s %10s %10s   %s\n", "kernel", "variant", "cycles/op", "ns/op", "checksum");
+
+    bench_vec4(data);
+    bench_ray(data);
+    bench_sphere(data);
+    bench_color(data);
+    bench_random();
+
+    return 0;
+}
@@ -5,27 +5,50 @@ pushd %~dp0
 
 set outputname=raytracer
 set outputexe="%outputname%.exe"
+set microbenchexe="%outputname%_microbench.exe"
 
 echo.
 
 set defines=/DNOMINMAX /DUNICODE /D_UNICODE /D_CRT_SECURE_NO_WARNINGS /DAE_PLATFORM_WIN32 /DVK_NO_PROTOTYPES
 set compiler_flags=/nologo /std:c++20 /FC /Zc:preprocessor /EHsc /GR- /WX /W4 /w44062 /wd4201 /wd4324
 set linker_flags=/nologo /INCREMENTAL:NO /SUBSYSTEM:CONSOLE
-set libs=kernel32.lib user32.lib
+set libs=kernel32.lib user32.lib ws2_32.lib
 
 set translation_units= ^
+..\src\bench.cpp ^
+..\src\checkpoint.cpp ^
+..\src\checkpoint_win32.cpp ^
 ..\src\color.cpp ^
 ..\src\commands.cpp ^
+..\src\farm.cpp ^
+..\src\hybrid_raytracer.cpp ^
 ..\src\main.cpp ^
+..\src\memory.cpp ^
+..\src\net_win32.cpp ^
 ..\src\output.cpp ^
 ..\src\output_win32.cpp ^
+..\src\perf_counters.cpp ^
+..\src\perf_counters_win32.cpp ^
 ..\src\random.cpp ^
 ..\src\raytracer.cpp ^
+..\src\regress.cpp ^
+..\src\rle.cpp ^
+..\src\scene.cpp ^
 ..\src\shapes.cpp ^
 ..\src\software_raytracer.cpp ^
+..\src\stats.cpp ^
 ..\src\system.cpp ^
+..\src\tiled_output.cpp ^
+..\src\trace.cpp ^
 ..\src\vulkan_raytracer.cpp
 
+set microbench_units= ^
+..\bench\microbench.cpp ^
+..\src\color.cpp ^
+..\src\random.cpp ^
+..\src\shapes.cpp ^
+..\src\system.cpp
+
 set "should_build_release="
 
 for %%x in (%*) do (
@@ -47,8 +70,25 @@ if defined should_build_release (
    set linker_flags=%linker_flags% /DEBUG:FULL /PDB:"%outputname%.pdb"
 )
 
+rem Chrome trace timeline, compiled out otherwise
+for %%x in (%*) do (
+    if "%%~x" == "--trace" set defines=%defines% /DAE_TRACE
+)
+
 echo.
 
+rem The compute shader gets embedded into the executable. There is no prebuilt SPIR-V to fall back on,
+rem it would go stale whenever the interface of compute.hlsl changes.
+where dxc >nul 2>nul
+if not %errorlevel% == 0 (
+    echo     dxc not found, it is needed to compile src\compute.hlsl
+    echo.
+    goto :end
+)
+
+dxc -spirv -T cs_6_0 -E main src\compute.hlsl -Fh src\compute_spirv.h -Vn compute_spirv >nul
+if errorlevel 1 goto :end
+
 if not exist bin mkdir bin
 
 pushd .\bin
@@ -67,7 +107,22 @@ if %errorlevel% == 0 (
     copy /b/y %outputexe% ..\%outputexe%
 )
 
+rem Kernel timings only mean something in a --release build
+cl %compiler_flags% ^
+    %defines% ^
+    /I"%~dp0\src" ^
+    %microbench_units% ^
+    /Fe: %microbenchexe% ^
+    /link %linker_flags% ^
+    %libs%
+
+if %errorlevel% == 0 (
+    copy /b/y %microbenchexe% ..\%microbenchexe%
+)
+
 popd
+
+:end
 popd
 
 echo.
@@ -10,7 +10,8 @@ compiler_flags="-std=c++20 -Werror -Wall -Wunused-parameter \
 defines="-D_POSIX_C_SOURCE=200809L -DAE_PLATFORM_LINUX -DVK_NO_PROTOTYPES"
 libs="-lstdc++ -lc -lm -lpthread"
 
-translation_units=$(find . -name "*.cpp" ! -name "*win32.cpp")
+translation_units=$(find src -name "*.cpp" ! -name "*win32.cpp")
+microbench_units="bench/microbench.cpp src/color.cpp src/random.cpp src/shapes.cpp src/system.cpp"
 
 if [[ "$*" == *"--release"* ]]
     then
@@ -23,6 +24,27 @@ if [[ "$*" == *"--release"* ]]
         defines="$defines -DAE_DEBUG"
 fi
 
+# Chrome trace timeline, compiled out otherwise
+if [[ "$*" == *"--trace"* ]]
+    then
+        defines="$defines -DAE_TRACE"
+fi
+
+# The compute shader gets embedded into the executable. There is no prebuilt SPIR-V to fall back on,
+# it would go stale whenever the interface of compute.hlsl changes.
+if ! command -v dxc > /dev/null
+    then
+        echo dxc not found, it is needed to compile src/compute.hlsl
+        popd > /dev/null
+        exit 1
+fi
+
+if ! dxc -spirv -T cs_6_0 -E main src/compute.hlsl -Fh src/compute_spirv.h -Vn compute_spirv > /dev/null
+    then
+        popd > /dev/null
+        exit 1
+fi
+
 clang++ $compiler_flags \
     $defines \
     -I src/ -I Vulkan-Headers/include/ \
@@ -30,4 +52,12 @@ clang++ $compiler_flags \
     $libs \
     -o raytracer
 
+# Kernel timings only mean something in a --release build
+clang++ $compiler_flags \
+    $defines \
+    -I src/ \
+    $microbench_units \
+    $libs \
+    -o raytracer_microbench
+
 popd > /dev/null
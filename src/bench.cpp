@@ -0,0 +1,249 @@
+#include "bench.h"
+
+#include "aemath.h"
+#include "commands.h"
+#include "raytracer.h"
+#include "software_raytracer.h"
+#include "system.h"
+#include "vulkan_raytracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+    constexpr u32 warmup_runs = 1;
+    constexpr u32 measured_runs = 5;
+
+    // The test scene with the camera at different distances from the viewport. Closer cameras see a wider
+    // field of view, which changes how many of the rays hit the sphere.
+    constexpr struct {
+        const char *name;
+        f32 camera_z;
+    } scenes[] = {
+        { "default", 1.0f },
+        { "wide", 0.25f }, // Mostly background
+        { "narrow", 4.0f } // Mostly sphere
+    };
+
+    constexpr u32 resolutions[] = { 256, 512, 1024 };
+
+    struct bench_result {
+        const char *backend_;
+        const char *scene_;
+        u32 width_ = 0;
+        u32 height_ = 0;
+        u32 threads_ = 0; // Threads tracing tiles, 0 for the compute device
+        f64 min_ms_ = 0.0;
+        f64 median_ms_ = 0.0;
+        f64 p90_ms_ = 0.0;
+        f64 p99_ms_ = 0.0;
+        f64 mrays_per_s_ = 0.0;
+        f64 scaling_efficiency_ = 0.0; // Speedup over one thread divided by the thread count
+    };
+
+    // Nearest rank, frame_times has to be sorted
+    f64 percentile(const std::vector<f64> &frame_times, u32 percent) {
+        const size_t rank = (frame_times.size() * percent + 99) / 100;
+        return frame_times[ae::max<size_t>(rank, 1) - 1];
+    }
+
+    // Runs render warmup_runs + measured_runs times and fills in the timings of the measured ones
+    template<typename TRender>
+    bool measure(bench_result &result, u32 samples_per_pixel, TRender render) {
+        std::vector<f64> frame_times;
+
+        for(u32 run = 0; run < warmup_runs + measured_runs; run++) {
+            const u64 start = ae::system_time_ns();
+
+            if(!render()) {
+                return false;
+            }
+
+            if(run >= warmup_runs) {
+                frame_times.push_back(static_cast<f64>(ae::system_time_ns() - start) / 1000000.0);
+            }
+        }
+
+        std::sort(frame_times.begin(), frame_times.end());
+
+        const f64 rays = static_cast<f64>(result.width_) * result.height_ * samples_per_pixel;
+
+        result.min_ms_ = frame_times.front();
+        result.median_ms_ = percentile(frame_times, 50);
+        result.p90_ms_ = percentile(frame_times, 90);
+        result.p99_ms_ = percentile(frame_times, 99);
+        result.mrays_per_s_ = rays / (ae::max(result.median_ms_, 0.001) * 1000.0);
+
+        return true;
+    }
+
+    void write_json(std::FILE *file, const std::vector<bench_result> &results) {
+        std::fprintf(file,
+                     "{\n"
+                     "  \"cpu_count\": %u,\n"
+                     "  \"tile_size\": %u,\n"
+                     "  \"warmup_runs\": %u,\n"
+                     "  \"runs\": %u,\n"
+                     "  \"results\": [",
+                     ae::system_cpu_count(),
+                     ae::raytracer::tile_size,
+                     warmup_runs,
+                     measured_runs);
+
+        for(size_t i = 0; i < results.size(); i++) {
+            const bench_result &r = results[i];
+
+            std::fprintf(file,
+                         "%s\n    { \"backend\": \"%s\", \"scene\": \"%s\", \"width\": %u, \"height\": %u",
+                         (i > 0) ? "," : "",
+                         r.backend_,
+                         r.scene_,
+                         r.width_,
+                         r.height_);
+
+            if(r.threads_ > 0) {
+                std::fprintf(file, ", \"threads\": %u", r.threads_);
+            }
+
+            std::fprintf(file,
+                         ", \"min_ms\": %.3f, \"median_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"mrays_per_s\": %.3f",
+                         r.min_ms_,
+                         r.median_ms_,
+                         r.p90_ms_,
+                         r.p99_ms_,
+                         r.mrays_per_s_);
+
+            if(r.threads_ > 0) {
+                std::fprintf(file, ", \"scaling_efficiency\": %.3f", r.scaling_efficiency_);
+            }
+
+            std::fprintf(file, " }");
+        }
+
+        std::fprintf(file, "\n  ]\n}\n");
+    }
+}
+
+namespace ae {
+
+bool run_benchmark() {
+    const ae::command_handler &cmdhandler = ae::command_handler::get();
+
+    const ae::command_handler::variant spp = cmdhandler.value("spp"_hash);
+    const u32 samples_per_pixel = std::holds_alternative<u32>(spp) ? ae::max(std::get<u32>(spp), 1u) : 1;
+
+    // 1, 2, 4, ... and all of them
+    std::vector<u32> thread_counts;
+    const u32 cpu_count = ae::system_cpu_count();
+
+    for(u32 count = 1; count < cpu_count; count *= 2) {
+        thread_counts.push_back(count);
+    }
+
+    thread_counts.push_back(cpu_count);
+
+    const ae::vec4f default_camera = ae::raytracer::camera_pos;
+    const auto [default_width, default_height] = ae::raytracer::get_resolution();
+
+    std::vector<bench_result> results;
+    std::vector<u32> buffer;
+    bool success = true;
+
+    for(const auto &scene : scenes) {
+        ae::raytracer::camera_pos = ae::vec4f(default_camera.x_, default_camera.y_, scene.camera_z);
+
+        for(const u32 resolution : resolutions) {
+            ae::raytracer::set_resolution(resolution, resolution);
+            buffer.assign(static_cast<size_t>(resolution) * resolution, 0);
+
+            f64 single_thread_ms = 0.0;
+
+            for(const u32 threads : thread_counts) {
+                bench_result result = {
+                    .backend_ = "software",
+                    .scene_ = scene.name,
+                    .width_ = resolution,
+                    .height_ = resolution,
+                    .threads_ = threads
+                };
+
+                if(!measure(result, samples_per_pixel, [&buffer, threads]() {
+                    ae::software_raytracer raytracer(buffer.data());
+                    raytracer.set_thread_count(threads);
+
+                    if(!raytracer.setup()) {
+                        return false;
+                    }
+
+                    return raytracer.trace();
+                })) {
+                    success = false;
+                    continue;
+                }
+
+                if(threads == 1) {
+                    single_thread_ms = result.median_ms_;
+                }
+
+                // Stays 0 without a single thread run to compare against
+                result.scaling_efficiency_ = single_thread_ms / (ae::max(result.median_ms_, 0.001) * threads);
+                results.push_back(result);
+            }
+        }
+    }
+
+    // The compute backend only traces single samples
+    if(ae::vulkan_raytracer::init()) {
+        ae::vulkan_raytracer raytracer(nullptr);
+
+        if(raytracer.setup()) {
+            for(const auto &scene : scenes) {
+                ae::raytracer::camera_pos = ae::vec4f(default_camera.x_, default_camera.y_, scene.camera_z);
+
+                for(const u32 resolution : resolutions) {
+                    ae::raytracer::set_resolution(resolution, resolution);
+                    buffer.assign(static_cast<size_t>(resolution) * resolution, 0);
+
+                    bench_result result = {
+                        .backend_ = "compute",
+                        .scene_ = scene.name,
+                        .width_ = resolution,
+                        .height_ = resolution
+                    };
+
+                    if(measure(result, 1, [&raytracer, &buffer]() {
+                        return raytracer.submit() && raytracer.collect(buffer.data());
+                    })) {
+                        results.push_back(result);
+                    } else {
+                        success = false;
+                    }
+                }
+            }
+        }
+    }
+
+    ae::raytracer::camera_pos = default_camera;
+    ae::raytracer::set_resolution(default_width, default_height);
+
+    const ae::command_handler::variant json_path = cmdhandler.value("bench-json"_hash);
+    std::FILE *file = std::holds_alternative<std::string>(json_path)
+        ? std::fopen(std::get<std::string>(json_path).c_str(), "w")
+        : stdout;
+
+    if(!file) {
+        return false;
+    }
+
+    write_json(file, results);
+
+    if(file != stdout) {
+        success = (std::fclose(file) == 0) && success;
+    }
+
+    return success;
+}
+
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "common.h"
+
+namespace ae {
+    // Renders the built-in scenes at several resolutions, on the CPU with increasing thread counts and
+    // on the compute device if there is one, and writes frame time percentiles, Mrays/s and thread scaling
+    // as JSON to --bench-json (stdout by default). Every configuration gets warm-up runs that aren't measured.
+    bool run_benchmark();
+}
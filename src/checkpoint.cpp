@@ -0,0 +1,122 @@
+#include "checkpoint.h"
+
+#include "raytracer.h"
+#include "system.h"
+
+#include <cstdio>
+
+namespace ae {
+
+checkpoint::checkpoint(std::string_view file_name, bool resume, u32 seed)
+    : path_(file_name) {
+    const raytracer::region region = raytracer::get_region();
+    const size_t pixel_count = static_cast<size_t>(region.width_) * region.height_;
+
+    accumulation_.assign(pixel_count, ae::vec4f());
+    sample_counts_.assign(pixel_count, 0);
+
+    if(resume) {
+        valid_ = load() && validate_header();
+    } else {
+        // Written right away, so a path that can't be written to fails before the render starts
+        initialize_header(seed);
+        valid_ = flush();
+    }
+}
+
+size_t checkpoint::file_size() {
+    const raytracer::region region = raytracer::get_region();
+    const size_t pixel_count = static_cast<size_t>(region.width_) * region.height_;
+
+    return sizeof(file_header)
+        + (pixel_count * sizeof(ae::vec4f))
+        + (pixel_count * sizeof(u32));
+}
+
+ae::vec4f * checkpoint::accumulation() {
+    return accumulation_.data();
+}
+
+u32 * checkpoint::sample_counts() {
+    return sample_counts_.data();
+}
+
+u32 checkpoint::seed() const {
+    return header_.seed_;
+}
+
+u32 checkpoint::completed_passes() const {
+    return header_.completed_passes_;
+}
+
+void checkpoint::set_completed_passes(u32 passes) {
+    header_.completed_passes_ = passes;
+}
+
+bool checkpoint::flush() {
+    // A crash while writing leaves the previous checkpoint in place
+    const std::string temp_path = path_ + ".tmp";
+
+    if(!write_file(temp_path) || !ae::system_replace_file(temp_path.c_str(), path_.c_str())) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void checkpoint::initialize_header(u32 seed) {
+    auto [w, h] = raytracer::get_resolution();
+    const raytracer::region region = raytracer::get_region();
+
+    header_ = {
+        .magic_ = checkpoint::magic,
+        .version_ = checkpoint::version,
+        .frame_width_ = w,
+        .frame_height_ = h,
+        .region_x_ = region.x_,
+        .region_y_ = region.y_,
+        .region_width_ = region.width_,
+        .region_height_ = region.height_,
+        .tile_size_ = raytracer::tile_size,
+        .seed_ = seed,
+        .completed_passes_ = 0,
+        .reserved_ = 0
+    };
+}
+
+bool checkpoint::validate_header() const {
+    auto [w, h] = raytracer::get_resolution();
+    const raytracer::region region = raytracer::get_region();
+
+    return header_.magic_ == checkpoint::magic
+        && header_.version_ == checkpoint::version
+        && header_.frame_width_ == w
+        && header_.frame_height_ == h
+        && header_.region_x_ == region.x_
+        && header_.region_y_ == region.y_
+        && header_.region_width_ == region.width_
+        && header_.region_height_ == region.height_
+        && header_.tile_size_ == raytracer::tile_size;
+}
+
+bool checkpoint::load() {
+    std::FILE *file = std::fopen(path_.c_str(), "rb");
+
+    if(!file) {
+        return false;
+    }
+
+    char trailing;
+
+    const bool complete = std::fread(&header_, sizeof(header_), 1, file) == 1
+        && std::fread(accumulation_.data(), sizeof(ae::vec4f), accumulation_.size(), file) == accumulation_.size()
+        && std::fread(sample_counts_.data(), sizeof(u32), sample_counts_.size(), file) == sample_counts_.size()
+        && std::fread(&trailing, 1, 1, file) == 0;
+
+    std::fclose(file);
+
+    return complete;
+}
+
+}
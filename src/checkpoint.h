@@ -0,0 +1,66 @@
+#pragma once
+
+#include "common.h"
+#include "memory.h"
+#include "vec.h"
+
+#include <string>
+#include <string_view>
+
+namespace ae {
+    // Render state (accumulation buffer, per-pixel sample counts, seed and pass number), kept in memory.
+    // flush() writes all of it to a temporary file that gets renamed over the checkpoint, so the file
+    // always holds a complete state from between two tiles, with the pass count that belongs to it.
+    class checkpoint {
+    public:
+        // Creates a fresh checkpoint file, or loads an existing one when resuming
+        checkpoint(std::string_view file_name, bool resume, u32 seed);
+
+        // False if the file couldn't be written or read, or doesn't match the current render settings
+        bool is_valid() const { return valid_; }
+
+        ae::vec4f * accumulation();
+        u32 * sample_counts();
+
+        u32 seed() const;
+        u32 completed_passes() const;
+        void set_completed_passes(u32 passes);
+
+        bool flush();
+
+        static size_t file_size();
+
+    private:
+        struct file_header {
+            u32 magic_;
+            u32 version_;
+            u32 frame_width_;
+            u32 frame_height_;
+            u32 region_x_;
+            u32 region_y_;
+            u32 region_width_;
+            u32 region_height_;
+            u32 tile_size_;
+            u32 seed_;
+            u32 completed_passes_;
+            u32 reserved_;
+        };
+        static_assert((sizeof(file_header) % alignof(ae::vec4f)) == 0);
+
+        static constexpr u32 magic = 0x4b434541; // "AECK"
+        static constexpr u32 version = 1;
+
+        void initialize_header(u32 seed);
+        bool validate_header() const;
+        bool load();
+
+        // Writes and syncs the whole state to path, platform specific
+        bool write_file(const std::string &path) const;
+
+        std::string path_;
+        file_header header_ = {};
+        ae::tracked_vector<ae::vec4f, ae::memory_category::framebuffer> accumulation_;
+        ae::tracked_vector<u32, ae::memory_category::framebuffer> sample_counts_;
+        bool valid_ = false;
+    };
+}
@@ -0,0 +1,44 @@
+#include "checkpoint.h"
+
+#include "common_linux.h"
+
+namespace ae {
+
+bool checkpoint::write_file(const std::string &path) const {
+    int fd = open(path.c_str(),
+                  O_CREAT | O_TRUNC | O_WRONLY,
+                  0644);
+
+    if(fd == -1) {
+        return false;
+    }
+
+    auto write_all = [fd](const void *data, size_t size) {
+        const u8 *bytes = static_cast<const u8 *>(data);
+
+        while(size > 0) {
+            const ssize_t written = write(fd, bytes, size);
+
+            if(written <= 0) {
+                return false;
+            }
+
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+
+        return true;
+    };
+
+    // Synced before the rename, otherwise a power loss could leave the renamed file empty
+    const bool success = write_all(&header_, sizeof(header_))
+        && write_all(accumulation_.data(), accumulation_.size() * sizeof(ae::vec4f))
+        && write_all(sample_counts_.data(), sample_counts_.size() * sizeof(u32))
+        && fsync(fd) == 0;
+
+    close(fd);
+
+    return success;
+}
+
+}
@@ -0,0 +1,49 @@
+#include "checkpoint.h"
+
+#include "common_win32.h"
+
+namespace ae {
+
+bool checkpoint::write_file(const std::string &path) const {
+    HANDLE handle = CreateFileA(path.c_str(),
+                                GENERIC_WRITE,
+                                0,
+                                nullptr,
+                                CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL,
+                                nullptr);
+
+    if(handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    auto write_all = [handle](const void *data, size_t size) {
+        const u8 *bytes = static_cast<const u8 *>(data);
+
+        while(size > 0) {
+            const DWORD chunk = static_cast<DWORD>((size > 0x40000000) ? 0x40000000 : size);
+            DWORD written = 0;
+
+            if(!WriteFile(handle, bytes, chunk, &written, nullptr) || written == 0) {
+                return false;
+            }
+
+            bytes += written;
+            size -= written;
+        }
+
+        return true;
+    };
+
+    // Flushed before the rename, otherwise a power loss could leave the renamed file empty
+    const bool success = write_all(&header_, sizeof(header_))
+        && write_all(accumulation_.data(), accumulation_.size() * sizeof(ae::vec4f))
+        && write_all(sample_counts_.data(), sample_counts_.size() * sizeof(u32))
+        && FlushFileBuffers(handle);
+
+    CloseHandle(handle);
+
+    return success;
+}
+
+}
@@ -47,17 +47,53 @@ command_handler::command_handler(std::span<char *> arguments) {
         { 1, "--width", "width"_hash, &command_handler::parse_u32, 512u },
         { 1, "--height", "height"_hash, &command_handler::parse_u32, 512u },
         { 0, "--compute", "compute"_hash, &command_handler::parse_bool, false },
-        { 1, "--output", "output"_hash, &command_handler::parse_str } // TODO: Not used currently. Will be used to write out the rendered image to a path
+        { 0, "--hybrid", "hybrid"_hash, &command_handler::parse_bool, false }, // Compute device and CPU share every frame
+        { 1, "--spp", "spp"_hash, &command_handler::parse_u32 }, // Samples per pixel, unlimited if only --time-budget is given
+        { 1, "--time-budget", "time-budget"_hash, &command_handler::parse_u32 }, // In seconds
+        { 1, "--snapshot-interval", "snapshot-interval"_hash, &command_handler::parse_u32 }, // In seconds
+        { 1, "--snapshot", "snapshot"_hash, &command_handler::parse_str },
+        { 1, "--tile-order", "tile-order"_hash, &command_handler::parse_str }, // row or cost, most expensive tiles first (default)
+        { 1, "--heatmap", "heatmap"_hash, &command_handler::parse_str }, // Tile cost image, with a CSV of the grid next to it
+        { 1, "--seed", "seed"_hash, &command_handler::parse_u32 },
+        { 1, "--checkpoint", "checkpoint"_hash, &command_handler::parse_str },
+        { 1, "--checkpoint-interval", "checkpoint-interval"_hash, &command_handler::parse_u32 }, // In seconds
+        { 0, "--resume", "resume"_hash, &command_handler::parse_bool, false },
+        { 1, "--crop", "crop"_hash, &command_handler::parse_str }, // x,y,w,h
+        { 1, "--shard", "shard"_hash, &command_handler::parse_str }, // i/n
+        { 1, "--merge", "merge"_hash, &command_handler::parse_str }, // Comma separated list of partial images
+        { 1, "--coordinator", "coordinator"_hash, &command_handler::parse_str }, // unix:<path> or [tcp:]<host>:<port>
+        { 1, "--worker", "worker"_hash, &command_handler::parse_str }, // Address of the coordinator
+        { 1, "--farm-rows", "farm-rows"_hash, &command_handler::parse_u32 }, // Tile rows per farm job
+        { 1, "--farm-timeout", "farm-timeout"_hash, &command_handler::parse_u32 }, // In seconds
+        { 1, "--frames", "frames"_hash, &command_handler::parse_u32 }, // Animation frames, numbered outputs if more than 1
+        { 1, "--cameras", "cameras"_hash, &command_handler::parse_str }, // x,y,z;x,y,z;... one numbered output per camera
+        { 1, "--frames-in-flight", "frames-in-flight"_hash, &command_handler::parse_u32 }, // Queued frames with --compute
+        { 0, "--tiled", "tiled"_hash, &command_handler::parse_bool, false }, // Band-at-a-time render into a tiled container
+        { 1, "--trace", "trace"_hash, &command_handler::parse_str }, // Timeline file of builds with AE_TRACE
+        { 0, "--perf-counters", "perf-counters"_hash, &command_handler::parse_bool, false }, // Hardware counters in the stats
+        { 0, "--stats", "stats"_hash, &command_handler::parse_bool, false }, // Timings report on stdout
+        { 1, "--stats-json", "stats-json"_hash, &command_handler::parse_str }, // Timings report as JSON
+        { 1, "--workgroup-size", "workgroup-size"_hash, &command_handler::parse_u32 }, // Side of the square compute workgroups
+        { 1, "--cache-dir", "cache-dir"_hash, &command_handler::parse_str }, // Pipeline cache location, per-user cache directory by default
+        { 0, "--bench", "bench"_hash, &command_handler::parse_bool, false }, // Benchmark sweep instead of a render
+        { 1, "--bench-json", "bench-json"_hash, &command_handler::parse_str }, // Benchmark results file, stdout by default
+        { 1, "--regress", "regress"_hash, &command_handler::parse_str }, // Directory of reference images and timings to check against
+        { 1, "--regress-baseline", "regress-baseline"_hash, &command_handler::parse_str }, // Timings of this machine, regress_baseline.txt by default
+        { 0, "--regress-update", "regress-update"_hash, &command_handler::parse_bool, false }, // Record the timings instead of checking them
+        { 0, "--regress-update-images", "regress-update-images"_hash, &command_handler::parse_bool, false }, // Rewrite the reference images
+        { 1, "--regress-tolerance", "regress-tolerance"_hash, &command_handler::parse_u32 }, // Per channel, 2 by default
+        { 1, "--regress-threshold", "regress-threshold"_hash, &command_handler::parse_u32 }, // Allowed slowdown in percent, 10 by default
+        { 1, "--output", "output"_hash, &command_handler::parse_str }
     };
 
-    u32 set_args = 0;
+    u64 set_args = 0;
     static_assert((sizeof(set_args) * 8) > AE_ARRAY_COUNT(table));
 
     for(u32 i = 0; i < arguments.size(); i++) {
         for(u32 j = 0; j < AE_ARRAY_COUNT(table); j++) {
             command_handler::variant var;
 
-            if(!(set_args & (1 << j))
+            if(!(set_args & (1ull << j))
                && ((i + table[j].operand_offset) < arguments.size())
                && std::strcmp(arguments[i], table[j].cmd) == 0
                && (this->*table[j].parse)(arguments[i + table[j].operand_offset], var)) {
@@ -65,7 +101,7 @@ command_handler::command_handler(std::span<char *> arguments) {
                 arguments_.insert({table[j].key, var});
 
                 i += table[j].operand_offset;
-                set_args |= (1 << j);
+                set_args |= (1ull << j);
 
                 break;
             }
@@ -7,7 +7,10 @@
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <immintrin.h>
+#include <signal.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #endif // AE_PLATFORM_LINUX
@@ -1,25 +1,57 @@
-// Compile using "dxc -spirv -T cs_6_0 -E main src/compute.hlsl -Fo ./compute.spv"
+// Compiled and embedded by build.sh/build.bat, which need dxc on the PATH
 
 struct scene_constants {
     float4 background0;
     float4 background1;
+    float4 view; // [xy] = pixel size on the viewport, [zw] = viewport corner relative to its center
+    uint4 bounds; // Rendered band, [xy] = first pixel, [zw] = one past the last
+    float inv_height;
+};
+
+// Layout matches ae::vulkan_raytracer::view
+struct view_camera {
     float4 cam;
-    float4 sphere;
+    float4 scene_offset;
+};
+
+// Layouts match ae::scene
+struct primitive {
+    float4 sphere; // [xyz] = center, [w] = radius
+    uint material;
+    uint3 padding;
+};
+
+struct material {
+    float4 albedo;
+};
+
+struct bvh_node {
+    float3 bounds_min;
+    uint first; // Left child for interior nodes (the right one follows it), first primitive for leaves
+    float3 bounds_max;
+    uint count; // 0 for interior nodes
 };
 
 [[vk::push_constant]] scene_constants scene;
-[[vk::binding(0, 0)]] RWTexture2D<float4> image;
+[[vk::binding(0, 0)]] RWTexture2DArray<float4> image; // One layer per view
+[[vk::binding(1, 0)]] StructuredBuffer<primitive> primitives;
+[[vk::binding(2, 0)]] StructuredBuffer<bvh_node> nodes;
+[[vk::binding(3, 0)]] StructuredBuffer<material> materials;
+[[vk::binding(4, 0)]] StructuredBuffer<view_camera> views;
+
+#define MAX_BVH_DEPTH 32
 
 struct hit_info {
     float3 pos;
     float3 normal;
     float t;
+    uint material;
 };
 
-bool has_intersection(in float3 origin, in float3 dir, out hit_info info) {
-    float radius = scene.sphere.w;
+bool intersect_sphere(in float4 sphere, in float3 origin, in float3 dir, inout hit_info info) {
+    float radius = sphere.w;
 
-    float3 oc = scene.sphere.xyz - origin;
+    float3 oc = sphere.xyz - origin;
     float a = dot(dir, dir);
     float b = -2.0 * dot(dir, oc);
     float c = dot(oc, oc) - radius * radius;
@@ -27,15 +59,68 @@ bool has_intersection(in float3 origin, in float3 dir, out hit_info info) {
     float discriminant = b * b - 4 * a * c;
 
     if(discriminant >= 0) {
-        info.t = (-b - sqrt(discriminant)) / (2.0 * a);
-        info.pos = origin + (dir * info.t);
-        info.normal = normalize(info.pos - scene.sphere.xyz);
-        return true;
+        float t = (-b - sqrt(discriminant)) / (2.0 * a);
+
+        if(t > 0.0 && t < info.t) {
+            info.t = t;
+            info.pos = origin + (dir * t);
+            info.normal = normalize(info.pos - sphere.xyz);
+            return true;
+        }
     }
 
     return false;
 }
 
+bool intersect_bounds(in float3 bounds_min, in float3 bounds_max, in float3 origin, in float3 inv_dir, in float t_max) {
+    float3 t0 = (bounds_min - origin) * inv_dir;
+    float3 t1 = (bounds_max - origin) * inv_dir;
+    float3 t_near = min(t0, t1);
+    float3 t_far = max(t0, t1);
+
+    float t_entry = max(max(t_near.x, t_near.y), max(t_near.z, 0.0));
+    float t_exit = min(min(t_far.x, t_far.y), min(t_far.z, t_max));
+
+    return t_entry <= t_exit;
+}
+
+// Closest hit along the ray, in the scene's rest space
+bool has_intersection(in float3 origin, in float3 dir, out hit_info info) {
+    info.pos = (float3)0;
+    info.normal = (float3)0;
+    info.t = 3.402823466e+38;
+    info.material = 0;
+
+    float3 inv_dir = 1.0 / dir;
+    bool hit = false;
+
+    uint stack[MAX_BVH_DEPTH];
+    uint stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0) {
+        bvh_node node = nodes[stack[--stack_size]];
+
+        if(!intersect_bounds(node.bounds_min, node.bounds_max, origin, inv_dir, info.t)) {
+            continue;
+        }
+
+        if(node.count > 0) {
+            for(uint i = node.first; i < node.first + node.count; i++) {
+                if(intersect_sphere(primitives[i].sphere, origin, dir, info)) {
+                    info.material = primitives[i].material;
+                    hit = true;
+                }
+            }
+        } else if(stack_size + 2 <= MAX_BVH_DEPTH) {
+            stack[stack_size++] = node.first + 1;
+            stack[stack_size++] = node.first;
+        }
+    }
+
+    return hit;
+}
+
 float3 remap(in float3 value,
              in float input_min,
              in float input_max,
@@ -53,36 +138,32 @@ float3 remap(in float3 value,
         / (i1 - i0);
 }
 
+// The workgroup size gets specialized when the pipeline is created
 [numthreads(16, 16, 1)]
 void main(uint3 id : SV_DispatchThreadID) {
-    float width, height;
-    image.GetDimensions(width, height);
-
-    // TODO: This can be done once on program startup instead
-    float w, h;
-    if(width > height) {
-        w = width / height;
-        h = 1.0;
-    } else {
-        w = 1.0;
-        h = height / width;
+    uint2 pixel = id.xy + scene.bounds.xy;
+
+    // Dispatches are rounded up to whole workgroups
+    if(any(pixel >= scene.bounds.zw)) {
+        return;
     }
 
-    float3 viewport = float3(w, h, 0);
-    float3 pixel_size = viewport / float3(width, height, 1.0);
+    float3 uv = float3((float2(pixel) + float2(0.5, 0.5)) * scene.view.xy + scene.view.zw, 0);
 
-    float3 uv = (float3(float2(id.xy) + float2(0.5, 0.5), 0) * pixel_size)
-        - (viewport * float3(0.5, 0.5, 1.0));
+    view_camera camera = views[id.z];
+    uint3 texel = uint3(pixel, id.z);
 
-    float3 origin = scene.cam.xyz;
+    float3 origin = camera.cam.xyz;
     float3 dir = normalize(uv - origin);
 
+    // Moving the ray against the animation keeps the uploaded scene valid for every frame
     hit_info info;
-    if(has_intersection(origin, dir, info)) {
-        image[id.xy] = float4(remap(info.normal, -1.0, 1.0, 0.0, 1.0), 1.0);
+    if(has_intersection(origin - camera.scene_offset.xyz, dir, info)) {
+        float3 albedo = materials[info.material].albedo.rgb;
+        image[texel] = float4(remap(info.normal, -1.0, 1.0, 0.0, 1.0) * albedo, 1.0);
     } else {
-        image[id.xy] = float4(lerp(scene.background0.gba,
+        image[texel] = float4(lerp(scene.background0.gba,
                                    scene.background1.gba,
-                                   float(id.y) / height), 1.0);
+                                   float(pixel.y) * scene.inv_height), 1.0);
     }
 }
@@ -0,0 +1,394 @@
+#include "farm.h"
+
+#include "commands.h"
+#include "net.h"
+#include "raytracer.h"
+#include "rle.h"
+#include "software_raytracer.h"
+#include "system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <vector>
+
+namespace {
+    constexpr u32 protocol_version = 1;
+    constexpr u32 max_message_size = 1u << 30;
+    constexpr u32 no_job = ~0u;
+
+    enum class message_type : u32 {
+        hello = 1,
+        reject,
+        request,
+        assign,
+        result,
+        finished
+    };
+
+    struct message_header {
+        u32 type_ = 0;
+        u32 size_ = 0;
+    };
+
+    struct hello_message {
+        u32 version_ = 0;
+        u32 width_ = 0;
+        u32 height_ = 0;
+        u32 spp_ = 0;
+        u32 seed_ = 0;
+    };
+
+    // Also prefixes the encoded pixels of a result message
+    struct job_message {
+        u32 job_ = 0;
+        u32 x_ = 0;
+        u32 y_ = 0;
+        u32 width_ = 0;
+        u32 height_ = 0;
+    };
+
+    struct farm_worker {
+        ae::net_socket socket_;
+        u64 assigned_time_ = 0;
+        u32 job_ = no_job;
+        u32 handshaken_ : 1 = 0;
+        u32 waiting_ : 1 = 0;
+    };
+
+    u32 get_u32(ae::strhash key, u32 fallback) {
+        const ae::command_handler::variant value = ae::command_handler::get().value(key);
+        return std::holds_alternative<u32>(value) ? std::get<u32>(value) : fallback;
+    }
+
+    // The options that have to match between the coordinator and its workers
+    hello_message local_hello() {
+        auto [width, height] = ae::raytracer::get_resolution();
+
+        return {
+            .version_ = protocol_version,
+            .width_ = width,
+            .height_ = height,
+            .spp_ = get_u32("spp"_hash, 0),
+            .seed_ = get_u32("seed"_hash, 0)
+        };
+    }
+
+    // Every job would get the whole budget and stop at a sample count that depends on the speed of its worker,
+    // so the frame would take jobs times longer and show seams between the bands
+    bool check_options() {
+        if(ae::command_handler::get().has("time-budget"_hash)) {
+            std::fprintf(stderr, "--time-budget can't be used with --coordinator or --worker, use --spp instead\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    bool send_message(const ae::net_socket &socket,
+                      message_type type,
+                      const void *payload = nullptr,
+                      size_t payload_size = 0,
+                      std::span<const u8> trailing = {}) {
+
+        const size_t size = payload_size + trailing.size();
+
+        if(size > max_message_size) {
+            return false;
+        }
+
+        const message_header header = {
+            .type_ = static_cast<u32>(type),
+            .size_ = static_cast<u32>(size)
+        };
+
+        return socket.send_all(&header, sizeof(header))
+            && (payload_size == 0 || socket.send_all(payload, payload_size))
+            && (trailing.empty() || socket.send_all(trailing.data(), trailing.size()));
+    }
+
+    bool receive_message(const ae::net_socket &socket, message_header &header, std::vector<u8> &payload) {
+        if(!socket.receive_all(&header, sizeof(header)) || header.size_ > max_message_size) {
+            return false;
+        }
+
+        payload.resize(header.size_);
+        return payload.empty() || socket.receive_all(payload.data(), payload.size());
+    }
+
+    template<typename TMessage>
+    bool read_payload(const std::vector<u8> &payload, TMessage &message) {
+        if(payload.size() < sizeof(message)) {
+            return false;
+        }
+
+        std::memcpy(&message, payload.data(), sizeof(message));
+        return true;
+    }
+}
+
+namespace ae {
+
+bool farm_run_coordinator(std::string_view address, u32 *framebuffer) {
+    const ae::raytracer::region region = ae::raytracer::get_region();
+
+    if(!framebuffer || region.width_ == 0 || region.height_ == 0 || !check_options()) {
+        return false;
+    }
+
+    ae::net_socket listener = ae::net_socket::listen(address);
+
+    if(!listener.is_valid()) {
+        return false;
+    }
+
+    // Jobs are bands spanning the whole width of the region, so their pixels are contiguous in the framebuffer
+    const u32 band_height = std::max(get_u32("farm-rows"_hash, 8), 1u) * ae::raytracer::tile_size;
+    const u64 job_timeout_ns = std::max(get_u32("farm-timeout"_hash, 60), 1u) * 1000000000ull;
+    const hello_message hello = local_hello();
+
+    std::vector<job_message> jobs;
+
+    for(u32 y = 0; y < region.height_; y += band_height) {
+        jobs.push_back({
+            .job_ = static_cast<u32>(jobs.size()),
+            .x_ = region.x_,
+            .y_ = region.y_ + y,
+            .width_ = region.width_,
+            .height_ = std::min(band_height, region.height_ - y)
+        });
+    }
+
+    std::deque<u32> pending_jobs;
+
+    for(u32 i = 0; i < jobs.size(); i++) {
+        pending_jobs.push_back(i);
+    }
+
+    std::vector<farm_worker> workers;
+    std::vector<ae::net_socket> sockets;
+    std::vector<u8> readable;
+    std::vector<u8> payload;
+    size_t completed_jobs = 0;
+
+    // A job held by a worker that goes away is handed out again before any new work
+    auto drop_worker = [&pending_jobs](farm_worker &worker) {
+        if(worker.job_ != no_job) {
+            pending_jobs.push_front(worker.job_);
+        }
+
+        worker.socket_.close();
+    };
+
+    auto handle_message = [&](farm_worker &worker) {
+        message_header header;
+
+        if(!receive_message(worker.socket_, header, payload)) {
+            return false;
+        }
+
+        switch(static_cast<message_type>(header.type_)) {
+            case message_type::hello: {
+                hello_message remote;
+
+                if(!read_payload(payload, remote) || std::memcmp(&remote, &hello, sizeof(hello)) != 0) {
+                    send_message(worker.socket_, message_type::reject);
+                    return false;
+                }
+
+                worker.handshaken_ = 1;
+                return true;
+            }
+
+            case message_type::request:
+                worker.waiting_ = 1;
+                return worker.handshaken_ != 0;
+
+            case message_type::result: {
+                job_message result;
+
+                if(worker.job_ == no_job
+                   || !read_payload(payload, result)
+                   || result.job_ != worker.job_
+                   || std::memcmp(&result, &jobs[worker.job_], sizeof(result)) != 0) {
+                    return false;
+                }
+
+                const job_message &job = jobs[worker.job_];
+                u32 *pixels = framebuffer + static_cast<size_t>(job.y_ - region.y_) * region.width_;
+
+                if(!ae::rle_decode(std::span(payload).subspan(sizeof(result)),
+                                   std::span(pixels, static_cast<size_t>(job.width_) * job.height_))) {
+                    return false;
+                }
+
+                worker.job_ = no_job;
+                worker.waiting_ = 1;
+                completed_jobs++;
+                return true;
+            }
+
+            default:
+                return false;
+        }
+    };
+
+    while(completed_jobs < jobs.size()) {
+        sockets.assign(1, listener);
+
+        for(const farm_worker &worker : workers) {
+            sockets.push_back(worker.socket_);
+        }
+
+        readable.assign(sockets.size(), 0);
+
+        if(!ae::net_socket::poll(sockets, readable, 250)) {
+            break;
+        }
+
+        if(readable[0]) {
+            if(ae::net_socket connection = listener.accept(); connection.is_valid()) {
+                // Don't let a worker that stops halfway through a message stall everyone else
+                connection.set_receive_timeout(10000);
+                workers.push_back({ .socket_ = connection });
+            }
+        }
+
+        const u64 now = ae::system_time_ns();
+
+        for(size_t i = 1; i < readable.size(); i++) {
+            if(readable[i] && !handle_message(workers[i - 1])) {
+                drop_worker(workers[i - 1]);
+            }
+        }
+
+        for(farm_worker &worker : workers) {
+            if(worker.socket_.is_valid() && worker.job_ != no_job && (now - worker.assigned_time_) > job_timeout_ns) {
+                drop_worker(worker);
+            }
+        }
+
+        for(farm_worker &worker : workers) {
+            if(pending_jobs.empty()) {
+                break;
+            }
+
+            if(worker.socket_.is_valid() && worker.waiting_) {
+                const u32 job = pending_jobs.front();
+                pending_jobs.pop_front();
+
+                worker.job_ = job;
+                worker.waiting_ = 0;
+                worker.assigned_time_ = now;
+
+                if(!send_message(worker.socket_, message_type::assign, &jobs[job], sizeof(jobs[job]))) {
+                    drop_worker(worker);
+                }
+            }
+        }
+
+        std::erase_if(workers, [](const farm_worker &worker) { return !worker.socket_.is_valid(); });
+    }
+
+    // Late workers still waiting in the listen backlog get dismissed as well
+    for(u8 pending = 1; ae::net_socket::poll(std::span(&listener, 1), std::span(&pending, 1), 0) && pending;) {
+        if(ae::net_socket connection = listener.accept(); connection.is_valid()) {
+            workers.push_back({ .socket_ = connection });
+        } else {
+            break;
+        }
+    }
+
+    for(farm_worker &worker : workers) {
+        send_message(worker.socket_, message_type::finished);
+        worker.socket_.close();
+    }
+
+    listener.close();
+
+    return completed_jobs == jobs.size();
+}
+
+bool farm_run_worker(std::string_view address) {
+    if(!check_options()) {
+        return false;
+    }
+
+    ae::net_socket connection;
+
+    // The coordinator might still be starting up
+    for(u32 attempt = 0; attempt < 100 && !connection.is_valid(); attempt++) {
+        connection = ae::net_socket::connect(address);
+
+        if(!connection.is_valid()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+
+    const hello_message hello = local_hello();
+
+    if(!connection.is_valid() || !send_message(connection, message_type::hello, &hello, sizeof(hello))) {
+        connection.close();
+        return false;
+    }
+
+    std::vector<u32> pixels;
+    std::vector<u8> encoded;
+    std::vector<u8> payload;
+    bool success = false;
+
+    // Every result doubles as the request for the next job, so a worker never writes to a coordinator
+    // that has already finished
+    bool connected = send_message(connection, message_type::request);
+
+    while(connected) {
+        message_header header;
+
+        if(!receive_message(connection, header, payload)) {
+            break;
+        }
+
+        if(static_cast<message_type>(header.type_) == message_type::finished) {
+            success = true;
+            break;
+        }
+
+        job_message job;
+
+        if(static_cast<message_type>(header.type_) != message_type::assign
+           || !read_payload(payload, job)
+           || job.width_ == 0 || job.height_ == 0
+           || (job.x_ % ae::raytracer::tile_size) != 0 || (job.y_ % ae::raytracer::tile_size) != 0
+           || (job.width_ % ae::raytracer::tile_size) != 0 || (job.height_ % ae::raytracer::tile_size) != 0
+           || (job.x_ + job.width_) > hello.width_ || (job.y_ + job.height_) > hello.height_) {
+            break;
+        }
+
+        pixels.assign(static_cast<size_t>(job.width_) * job.height_, 0);
+
+        ae::software_raytracer raytracer(pixels.data(), {
+            .x_ = job.x_,
+            .y_ = job.y_,
+            .width_ = job.width_,
+            .height_ = job.height_
+        });
+
+        if(!raytracer.setup() || !raytracer.trace()) {
+            break;
+        }
+
+        encoded.clear();
+        ae::rle_encode(pixels, encoded);
+
+        connected = send_message(connection, message_type::result, &job, sizeof(job), encoded);
+    }
+
+    connection.close();
+
+    return success;
+}
+
+}
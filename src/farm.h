@@ -0,0 +1,15 @@
+#pragma once
+
+#include "common.h"
+
+#include <string_view>
+
+namespace ae {
+    // Local render farm. The coordinator splits the frame into bands of tile rows and hands them out
+    // on request over a length-prefixed protocol; workers trace them with the software raytracer and
+    // stream back run-length encoded pixels. Work held by a worker that disconnects or stalls is
+    // handed to the next worker that asks. Workers must be started with the same render options, which
+    // can't include --time-budget: the farm renders a fixed --spp.
+    bool farm_run_coordinator(std::string_view address, u32 *framebuffer);
+    bool farm_run_worker(std::string_view address);
+}
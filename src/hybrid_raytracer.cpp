@@ -0,0 +1,110 @@
+#include "hybrid_raytracer.h"
+
+#include "aemath.h"
+#include "software_raytracer.h"
+#include "system.h"
+
+#include <thread>
+
+namespace ae {
+
+hybrid_raytracer::hybrid_raytracer(u32 *buffer)
+    : raytracer(buffer)
+    , device_(nullptr) {}
+
+bool hybrid_raytracer::setup() {
+    if(!device_.setup()) {
+        return false;
+    }
+
+    // Every frame is traced into the same buffer, so the device can copy its band there directly
+    if(framebuffer_) {
+        const ae::raytracer::region region = ae::raytracer::get_region();
+        device_.import_destination(framebuffer_, static_cast<size_t>(region.width_) * region.height_ * sizeof(u32));
+    }
+
+    return true;
+}
+
+bool hybrid_raytracer::trace() {
+    return render(framebuffer_);
+}
+
+bool hybrid_raytracer::render(u32 *buffer) {
+    const ae::raytracer::region region = ae::raytracer::get_region();
+    const u32 tile_rows = region.height_ / ae::raytracer::tile_size;
+
+    if(!buffer || region.width_ == 0 || tile_rows == 0) {
+        return false;
+    }
+
+    // Both sides keep at least one tile row, a side that fell behind once could never be measured again otherwise
+    u32 device_rows = tile_rows;
+
+    if(tile_rows > 1) {
+        device_rows = ae::clamp(static_cast<u32>(device_share_ * static_cast<f32>(tile_rows) + 0.5f), 1u, tile_rows - 1);
+    }
+
+    const ae::raytracer::region device_band = {
+        .x_ = region.x_,
+        .y_ = region.y_,
+        .width_ = region.width_,
+        .height_ = device_rows * ae::raytracer::tile_size
+    };
+
+    const ae::raytracer::region software_band = {
+        .x_ = region.x_,
+        .y_ = region.y_ + device_band.height_,
+        .width_ = region.width_,
+        .height_ = region.height_ - device_band.height_
+    };
+
+    const u64 start_time = ae::system_time_ns();
+
+    if(!device_.submit(buffer, device_band)) {
+        return false;
+    }
+
+    // The device band gets collected on its own thread, so its completion time is known
+    // even when it finishes before the software band
+    u64 device_end_time = start_time;
+    bool device_done = false;
+
+    std::thread collector([this, buffer, &device_end_time, &device_done]() {
+        device_done = device_.collect(buffer);
+        device_end_time = ae::system_time_ns();
+    });
+
+    u64 software_end_time = start_time;
+    bool software_done = true;
+
+    if(software_band.height_ > 0) {
+        // Bands span the whole region, so the software band starts right after the device band in the buffer
+        ae::software_raytracer software(buffer + static_cast<size_t>(device_band.height_) * region.width_, software_band);
+
+        software_done = software.setup() && software.trace();
+
+        software_end_time = ae::system_time_ns();
+    }
+
+    collector.join();
+
+    if(!device_done || !software_done) {
+        return false;
+    }
+
+    if(software_band.height_ > 0) {
+        const f64 device_rate = static_cast<f64>(device_band.height_)
+            / static_cast<f64>(ae::max<u64>(device_end_time - start_time, 1));
+        const f64 software_rate = static_cast<f64>(software_band.height_)
+            / static_cast<f64>(ae::max<u64>(software_end_time - start_time, 1));
+
+        // Smoothed, so a single noisy frame doesn't throw the split around
+        const f32 target_share = static_cast<f32>(device_rate / (device_rate + software_rate));
+        device_share_ = 0.5f * device_share_ + 0.5f * target_share;
+    }
+
+    return true;
+}
+
+}
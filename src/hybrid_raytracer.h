@@ -0,0 +1,32 @@
+#pragma once
+
+#include "raytracer.h"
+#include "vulkan_raytracer.h"
+
+namespace ae {
+    // Splits every frame into two horizontal bands: the top one goes to the compute device, the bottom one
+    // to the software worker pool, and both are traced at the same time. The split follows the throughput
+    // each side reached on the previous frames, so both bands tend to finish together.
+    // Only single sample renders are supported, the compute backend doesn't accumulate samples.
+    class hybrid_raytracer final : public raytracer {
+    public:
+        hybrid_raytracer(u32 *buffer);
+
+        bool setup() override;
+        bool trace() override;
+
+        // Traces one frame of the region into buffer
+        bool render(u32 *buffer);
+
+        // Lets the device copy its band straight into buffer, see vulkan_raytracer::import_destination()
+        bool import_destination(u32 *buffer, size_t size) { return device_.import_destination(buffer, size); }
+        void release_destination(const u32 *buffer) { device_.release_destination(buffer); }
+
+        // Share of the tile rows that the next frame hands to the compute device
+        f32 device_share() const { return device_share_; }
+
+    private:
+        ae::vulkan_raytracer device_;
+        f32 device_share_ = 0.5f;
+    };
+}
@@ -1,59 +1,392 @@
+#include "aemath.h"
+#include "bench.h"
 #include "commands.h"
+#include "farm.h"
+#include "hybrid_raytracer.h"
+#include "memory.h"
+#include "net.h"
 #include "output.h"
+#include "regress.h"
 #include "software_raytracer.h"
+#include "stats.h"
 #include "system.h"
+#include "tiled_output.h"
+#include "trace.h"
 #include "vulkan_raytracer.h"
 
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
-static void run_raytracer(void *buffer);
+static bool run_raytracer(std::string_view file_name);
+static bool parse_cameras(const std::string &list, std::vector<ae::vec4f> &cameras);
+static bool run_views(std::string_view file_name, const std::vector<ae::vec4f> &cameras);
+static std::string frame_file_name(std::string_view file_name, u32 frame, u32 frame_count);
+static bool run_tiled(std::string_view file_name);
+static bool run_merge(const std::string &partial_file_names, std::string_view file_name);
 
 int main(int argc, char *argv[]) {
     ae::system_init();
+    ae::stats_record("startup", "system_init", ae::stats_elapsed_ms(ae::system_start_time_ns()));
 
+    const u64 commands_start = ae::system_time_ns();
     ae::command_handler::create(std::span(argv, argc));
+    ae::stats_record("startup", "command_handler_create", ae::stats_elapsed_ms(commands_start));
 
-    std::unique_ptr<ae::output> output =
-        std::make_unique<ae::output>(std::string_view("output.tga"));
+    const ae::command_handler &cmdhandler = ae::command_handler::get();
+    const ae::command_handler::variant output_name = cmdhandler.value("output"_hash);
+
+    const bool tiled = std::get<bool>(cmdhandler.value("tiled"_hash));
+
+    const std::string_view file_name = std::holds_alternative<std::string>(output_name)
+        ? std::string_view(std::get<std::string>(output_name))
+        : std::string_view(tiled ? "output.aet" : "output.tga");
+
+    int result = 0;
+
+    if(const ae::command_handler::variant merge = cmdhandler.value("merge"_hash);
+       std::holds_alternative<std::string>(merge)) {
+
+        result = run_merge(std::get<std::string>(merge), file_name) ? 0 : 1;
+    } else if(const ae::command_handler::variant worker = cmdhandler.value("worker"_hash);
+              std::holds_alternative<std::string>(worker)) {
+
+        result = (ae::net_socket::startup() && ae::farm_run_worker(std::get<std::string>(worker))) ? 0 : 1;
+        ae::net_socket::shutdown();
+    } else if(const ae::command_handler::variant coordinator = cmdhandler.value("coordinator"_hash);
+              std::holds_alternative<std::string>(coordinator)) {
+
+        std::unique_ptr<ae::output> output =
+            std::make_unique<ae::output>(file_name);
 
-    run_raytracer(output->get_buffer());
+        result = (ae::net_socket::startup()
+                  && ae::farm_run_coordinator(std::get<std::string>(coordinator),
+                                              reinterpret_cast<u32 *>(output->get_buffer()))) ? 0 : 1;
+        ae::net_socket::shutdown();
+    } else if(std::get<bool>(cmdhandler.value("bench"_hash))) {
+        result = ae::run_benchmark() ? 0 : 1;
+    } else if(cmdhandler.has("regress"_hash)) {
+        result = ae::run_regression() ? 0 : 1;
+    } else if(tiled) {
+        result = run_tiled(file_name) ? 0 : 1;
+    } else {
+        result = run_raytracer(file_name) ? 0 : 1;
+    }
+
+    if(!AE_TRACE_WRITE() && result == 0) {
+        result = 1;
+    }
+
+    ae::memory_record_stats();
+
+    if(!ae::stats_report() && result == 0) {
+        result = 1;
+    }
 
     ae::vulkan_raytracer::terminate();
     ae::command_handler::destroy();
 
-    return 0;
+    return result;
+}
+
+bool run_raytracer(std::string_view file_name) {
+    const ae::command_handler &cmdhandler = ae::command_handler::get();
+
+    if(const ae::command_handler::variant cameras = cmdhandler.value("cameras"_hash);
+       std::holds_alternative<std::string>(cameras)) {
+
+        std::vector<ae::vec4f> positions;
+        return parse_cameras(std::get<std::string>(cameras), positions) && run_views(file_name, positions);
+    }
+    const ae::command_handler::variant frames = cmdhandler.value("frames"_hash);
+    const u32 frame_count = std::holds_alternative<u32>(frames) ? ae::max(std::get<u32>(frames), 1u) : 1;
+
+    // The compute backend traces a single sample and has no checkpoints, so those renders stay on the CPU
+    const ae::command_handler::variant spp = cmdhandler.value("spp"_hash);
+    const bool single_sample = (!std::holds_alternative<u32>(spp) || std::get<u32>(spp) <= 1)
+        && !cmdhandler.has("time-budget"_hash)
+        && !cmdhandler.has("checkpoint"_hash)
+        && !std::get<bool>(cmdhandler.value("resume"_hash))
+        && !cmdhandler.has("snapshot-interval"_hash);
+
+    const bool hybrid = std::get<bool>(cmdhandler.value("hybrid"_hash));
+    const bool compute = cmdhandler.has("compute"_hash) && std::get<bool>(cmdhandler.value("compute"_hash));
+
+    if((hybrid || compute) && !single_sample) {
+        std::fprintf(stderr,
+                     "%s traces a single sample without checkpoints or snapshots, rendering on the CPU instead\n",
+                     hybrid ? "--hybrid" : "--compute");
+    }
+
+    const ae::raytracer::region region = ae::raytracer::get_region();
+    const size_t frame_bytes = static_cast<size_t>(region.width_) * region.height_ * sizeof(u32);
+
+    if(hybrid && single_sample && ae::vulkan_raytracer::init()) {
+
+        ae::hybrid_raytracer raytracer(nullptr);
+
+        if(raytracer.setup()) {
+            for(u32 frame = 0; frame < frame_count; frame++) {
+                ae::raytracer::set_frame(frame, frame_count);
+
+                ae::output output(frame_file_name(file_name, frame, frame_count));
+                u32 *buffer = reinterpret_cast<u32 *>(output.get_buffer());
+
+                // The device band is copied straight into the output if it can be imported
+                raytracer.import_destination(buffer, frame_bytes);
+                const bool rendered = raytracer.render(buffer);
+                raytracer.release_destination(buffer);
+
+                if(!rendered) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+    }
+
+    if(compute && single_sample) {
+        // Outputs of frames in flight stay open and are imported, so the device can write straight into them.
+        // They are declared first, so the raytracer is done with them before they get unmapped.
+        std::deque<std::unique_ptr<ae::output>> outputs;
+
+        // Loading Vulkan and bringing up the device dominate short jobs, the first output gets created meanwhile
+        std::thread output_thread([&outputs, file_name, frame_count]() {
+            outputs.push_back(std::make_unique<ae::output>(frame_file_name(file_name, 0, frame_count)));
+        });
+
+        // Frames are collected straight into their outputs, so there is no buffer to hand over up front
+        ae::vulkan_raytracer raytracer(nullptr);
+
+        const u64 setup_start = ae::system_time_ns();
+        const bool ready = ae::vulkan_raytracer::init() && raytracer.setup();
+
+        output_thread.join();
+        ae::stats_record("startup", "compute_setup", ae::stats_elapsed_ms(setup_start));
+
+        if(ready) {
+            u32 submitted = 0;
+
+            for(u32 frame = 0; frame < frame_count; frame++) {
+                // Keep the device busy with the following frames while this one is read back and written out
+                while(submitted < frame_count && raytracer.pending_frames() < raytracer.frames_in_flight()) {
+                    ae::raytracer::set_frame(submitted, frame_count);
+
+                    if(submitted > 0) {
+                        outputs.push_back(std::make_unique<ae::output>(frame_file_name(file_name, submitted, frame_count)));
+                    }
+
+                    u32 *destination = reinterpret_cast<u32 *>(outputs.back()->get_buffer());
+
+                    // Without an import collect() copies the frame over from the readback buffer instead
+                    if(destination) {
+                        raytracer.import_destination(destination, frame_bytes);
+                    }
+
+                    if(!destination || !raytracer.submit(destination)) {
+                        return false;
+                    }
+
+                    submitted++;
+                }
+
+                u32 *collected = reinterpret_cast<u32 *>(outputs.front()->get_buffer());
+
+                if(!raytracer.collect(collected)) {
+                    return false;
+                }
+
+                raytracer.release_destination(collected);
+                outputs.pop_front();
+            }
+
+            return true;
+        }
+    }
+
+    for(u32 frame = 0; frame < frame_count; frame++) {
+        ae::raytracer::set_frame(frame, frame_count);
+
+        ae::output output(frame_file_name(file_name, frame, frame_count));
+        u32 *buffer = reinterpret_cast<u32 *>(output.get_buffer());
+
+        if(!buffer) {
+            return false;
+        }
+
+        ae::software_raytracer raytracer(buffer);
+
+        if(!raytracer.setup()) {
+            // TODO: Print an error message to stderr
+            return false;
+        }
+
+        if(!raytracer.trace()) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-void run_raytracer(void *buffer) {
-    std::unique_ptr<ae::raytracer> raytracer;
+bool parse_cameras(const std::string &list, std::vector<ae::vec4f> &cameras) {
+    // x,y,z;x,y,z;...
+    const char *str = list.c_str();
+
+    while(*str) {
+        f32 position[3];
 
-    auto create_software_raytracer = [&raytracer, buffer]() {
-        raytracer = std::make_unique<ae::software_raytracer>(reinterpret_cast<u32 *>(buffer));
-        return raytracer->setup();
-    };
+        for(u32 i = 0; i < 3; i++) {
+            char *end;
+            position[i] = std::strtof(str, &end);
 
-    ae::command_handler::variant variant;
-    bool success = false;
+            const char separator = (i < 2) ? ',' : ';';
+
+            if(end == str || (*end != separator && !(i == 2 && *end == '\0'))) {
+                return false;
+            }
+
+            str = (*end == '\0') ? end : (end + 1);
+        }
+
+        cameras.emplace_back(position[0], position[1], position[2]);
+    }
+
+    return !cameras.empty();
+}
 
+bool run_views(std::string_view file_name, const std::vector<ae::vec4f> &cameras) {
     const ae::command_handler &cmdhandler = ae::command_handler::get();
+    const u32 view_count = static_cast<u32>(cameras.size());
 
-    if(cmdhandler.has("compute"_hash)
-       && std::get<bool>(cmdhandler.value("compute"_hash))
-       && ae::vulkan_raytracer::init()) {
+    // Every view shows the still scene from its own camera and gets a numbered output
+    ae::raytracer::set_frame(0, 1);
 
-        raytracer = std::make_unique<ae::vulkan_raytracer>(reinterpret_cast<u32 *>(buffer));
-        success = raytracer->setup();
+    if(std::get<bool>(cmdhandler.value("compute"_hash)) && ae::vulkan_raytracer::init()) {
+        ae::vulkan_raytracer raytracer(nullptr);
 
-        if(!success) {
-            success = create_software_raytracer();
+        if(raytracer.setup()) {
+            for(u32 first = 0; first < view_count; first += ae::vulkan_raytracer::max_batch_views) {
+                const u32 batch_size = ae::min(ae::vulkan_raytracer::max_batch_views, view_count - first);
+
+                std::vector<ae::vulkan_raytracer::view> views;
+                std::vector<std::unique_ptr<ae::output>> outputs;
+                std::vector<u32 *> buffers;
+
+                for(u32 i = first; i < first + batch_size; i++) {
+                    views.push_back({ .camera_pos_ = cameras[i], .scene_offset_ = ae::raytracer::scene_offset });
+                    outputs.push_back(std::make_unique<ae::output>(frame_file_name(file_name, i, view_count)));
+                    buffers.push_back(reinterpret_cast<u32 *>(outputs.back()->get_buffer()));
+
+                    if(!buffers.back()) {
+                        return false;
+                    }
+                }
+
+                if(!raytracer.submit_views(views) || !raytracer.collect_views(buffers)) {
+                    return false;
+                }
+            }
+
+            return true;
         }
-    } else {
-        success = create_software_raytracer();
     }
 
-    if(success) {
-        raytracer->trace();
-    } else {
-        // TODO: Print an error message to stderr
+    const ae::vec4f default_camera = ae::raytracer::camera_pos;
+    bool success = true;
+
+    for(u32 i = 0; i < view_count && success; i++) {
+        ae::raytracer::camera_pos = cameras[i];
+
+        ae::output output(frame_file_name(file_name, i, view_count));
+        u32 *buffer = reinterpret_cast<u32 *>(output.get_buffer());
+
+        ae::software_raytracer raytracer(buffer);
+        success = buffer && raytracer.setup() && raytracer.trace();
     }
+
+    ae::raytracer::camera_pos = default_camera;
+
+    return success;
+}
+
+std::string frame_file_name(std::string_view file_name, u32 frame, u32 frame_count) {
+    if(frame_count == 1) {
+        return std::string(file_name);
+    }
+
+    // Frame numbers go in front of the extension: output.tga -> output_0000.tga
+    const size_t separator = file_name.find_last_of("/\\");
+    size_t extension = file_name.rfind('.');
+
+    if(extension == std::string_view::npos || (separator != std::string_view::npos && extension < separator)) {
+        extension = file_name.size();
+    }
+
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%04u", frame);
+
+    return std::string(file_name.substr(0, extension)) + number + std::string(file_name.substr(extension));
+}
+
+bool run_tiled(std::string_view file_name) {
+    const ae::output::image_layout layout = ae::output::default_layout();
+    ae::tiled_output output(file_name, layout);
+
+    if(!output.is_valid()) {
+        return false;
+    }
+
+    // Only one chunk of a band is resident at a time, so memory stays bounded no matter how large the image is.
+    // Chunks span whole blocks and can be handed to the container as soon as they are traced.
+    constexpr u32 chunk_width = 64 * ae::tiled_output::block_size;
+    std::vector<u32> chunk(static_cast<size_t>(chunk_width) * ae::tiled_output::block_size);
+
+    for(u32 y = 0; y < layout.height_; y += ae::tiled_output::block_size) {
+        for(u32 x = 0; x < layout.width_; x += chunk_width) {
+            const ae::raytracer::region region = {
+                .x_ = layout.x_ + x,
+                .y_ = layout.y_ + y,
+                .width_ = ae::min(chunk_width, layout.width_ - x),
+                .height_ = ae::min(ae::tiled_output::block_size, layout.height_ - y)
+            };
+
+            ae::software_raytracer raytracer(chunk.data(), region);
+
+            if(!raytracer.setup() || !raytracer.trace()) {
+                return false;
+            }
+
+            if(!output.write(chunk.data(), x, y, region.width_, region.height_)) {
+                return false;
+            }
+        }
+    }
+
+    return output.finish();
+}
+
+bool run_merge(const std::string &partial_file_names, std::string_view file_name) {
+    std::vector<std::string> file_names;
+
+    for(size_t start = 0; start <= partial_file_names.size();) {
+        size_t end = partial_file_names.find(',', start);
+
+        if(end == std::string::npos) {
+            end = partial_file_names.size();
+        }
+
+        if(end > start) {
+            file_names.emplace_back(partial_file_names.substr(start, end - start));
+        }
+
+        start = end + 1;
+    }
+
+    return ae::output::merge(file_names, file_name);
 }
@@ -0,0 +1,54 @@
+#include "memory.h"
+
+#include "stats.h"
+#include "system.h"
+
+#include <atomic>
+#include <string>
+
+namespace {
+    constexpr u32 category_count = static_cast<u32>(ae::memory_category::count);
+
+    // In the order of ae::memory_category
+    constexpr const char *category_names[category_count] = {
+        "framebuffer",
+        "tiles",
+        "scene",
+        "acceleration",
+        "vulkan"
+    };
+
+    std::atomic<u64> memory_current[category_count];
+    std::atomic<u64> memory_peak[category_count];
+
+    constexpr f64 bytes_per_mib = 1024.0 * 1024.0;
+}
+
+namespace ae {
+
+void memory_allocated(memory_category category, u64 bytes) {
+    const u32 index = static_cast<u32>(category);
+    const u64 current = memory_current[index].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+    u64 peak = memory_peak[index].load(std::memory_order_relaxed);
+
+    while(current > peak && !memory_peak[index].compare_exchange_weak(peak, current, std::memory_order_relaxed)) {}
+}
+
+void memory_freed(memory_category category, u64 bytes) {
+    memory_current[static_cast<u32>(category)].fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void memory_record_stats() {
+    for(u32 i = 0; i < category_count; i++) {
+        const u64 peak = memory_peak[i].load(std::memory_order_relaxed);
+
+        if(peak > 0) {
+            ae::stats_record("memory", std::string(category_names[i]) + "_peak", static_cast<f64>(peak) / bytes_per_mib, "MiB");
+        }
+    }
+
+    ae::stats_record("memory", "peak_rss", static_cast<f64>(ae::system_peak_rss_bytes()) / bytes_per_mib, "MiB");
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace ae {
+    enum class memory_category : u32 {
+        framebuffer,  // Output mappings and accumulation buffers
+        tiles,        // Tiles in flight and per tile statistics
+        scene,        // Primitives and materials
+        acceleration, // BVH nodes
+        vulkan,       // Device memory, not counting imported host memory
+        count
+    };
+
+    // Bytes currently held and the most ever held at once per category. Safe to call from any thread.
+    void memory_allocated(memory_category category, u64 bytes);
+    void memory_freed(memory_category category, u64 bytes);
+
+    // Peaks of every category and the peak resident set size of the process, recorded into the stats
+    void memory_record_stats();
+
+    // Allocator for standard containers that accounts its memory to a category
+    template<typename T, memory_category TCategory>
+    struct tracked_allocator {
+        using value_type = T;
+
+        template<typename U>
+        struct rebind {
+            using other = tracked_allocator<U, TCategory>;
+        };
+
+        tracked_allocator() = default;
+
+        template<typename U>
+        tracked_allocator(const tracked_allocator<U, TCategory> &) {}
+
+        T * allocate(size_t count) {
+            ae::memory_allocated(TCategory, count * sizeof(T));
+            return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(alignof(T))));
+        }
+
+        void deallocate(T *pointer, size_t count) {
+            ae::memory_freed(TCategory, count * sizeof(T));
+            ::operator delete(pointer, std::align_val_t(alignof(T)));
+        }
+
+        template<typename U>
+        bool operator==(const tracked_allocator<U, TCategory> &) const { return true; }
+    };
+
+    template<typename T, memory_category TCategory>
+    using tracked_vector = std::vector<T, tracked_allocator<T, TCategory>>;
+}
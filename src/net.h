@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+
+#include <span>
+#include <string_view>
+
+namespace ae {
+    // Minimal blocking stream sockets, just enough for the render farm protocol.
+    // Addresses are either "unix:<path>" (Linux only) or "[tcp:]<host>:<port>".
+    class net_socket {
+    public:
+        static bool startup();
+        static void shutdown();
+
+        static net_socket listen(std::string_view address);
+        static net_socket connect(std::string_view address);
+
+        // Waits up to timeout_ms for input (or a closed connection) on any of the sockets.
+        // readable must have the same size as sockets and receives 1 for every socket that is ready.
+        static bool poll(std::span<const net_socket> sockets, std::span<u8> readable, u32 timeout_ms);
+
+        net_socket() = default;
+
+        net_socket accept() const;
+        bool send_all(const void *data, size_t size) const;
+        bool receive_all(void *data, size_t size) const;
+        void set_receive_timeout(u32 timeout_ms) const;
+        void close();
+
+        bool is_valid() const { return handle_ != invalid_handle; }
+
+    private:
+        static constexpr intptr_t invalid_handle = -1;
+
+        explicit net_socket(intptr_t handle)
+            : handle_(handle) {}
+
+        intptr_t handle_ = invalid_handle;
+    };
+}
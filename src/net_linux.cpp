@@ -0,0 +1,237 @@
+#include "net.h"
+
+#include "common_linux.h"
+
+#include <cstring>
+#include <netdb.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <vector>
+
+namespace {
+    constexpr std::string_view unix_prefix = "unix:";
+    constexpr std::string_view tcp_prefix = "tcp:";
+
+    bool make_unix_address(std::string_view path, sockaddr_un &address) {
+        address = {};
+        address.sun_family = AF_UNIX;
+
+        if(path.empty() || path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+
+        std::memcpy(address.sun_path, path.data(), path.size());
+        return true;
+    }
+
+    addrinfo * resolve_tcp_address(std::string_view address, bool passive) {
+        if(address.starts_with(tcp_prefix)) {
+            address.remove_prefix(tcp_prefix.size());
+        }
+
+        const size_t separator = address.rfind(':');
+
+        if(separator == std::string_view::npos) {
+            return nullptr;
+        }
+
+        const std::string host(address.substr(0, separator));
+        const std::string port(address.substr(separator + 1));
+
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+        addrinfo *result = nullptr;
+        const bool any_host = host.empty() || host == "*";
+
+        if(getaddrinfo(any_host ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0) {
+            return nullptr;
+        }
+
+        return result;
+    }
+}
+
+namespace ae {
+
+bool net_socket::startup() {
+    return true;
+}
+
+void net_socket::shutdown() {}
+
+net_socket net_socket::listen(std::string_view address) {
+    if(address.starts_with(unix_prefix)) {
+        const std::string_view path = address.substr(unix_prefix.size());
+        sockaddr_un unix_address;
+
+        if(!make_unix_address(path, unix_address)) {
+            return {};
+        }
+
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if(fd == -1) {
+            return {};
+        }
+
+        // A stale socket file from an earlier run would make bind fail
+        unlink(unix_address.sun_path);
+
+        if(bind(fd, reinterpret_cast<sockaddr *>(&unix_address), sizeof(unix_address)) != 0
+           || ::listen(fd, SOMAXCONN) != 0) {
+            ::close(fd);
+            return {};
+        }
+
+        return net_socket(fd);
+    }
+
+    addrinfo *info = resolve_tcp_address(address, true);
+    int fd = -1;
+
+    for(addrinfo *it = info; it && fd == -1; it = it->ai_next) {
+        fd = ::socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+
+        if(fd != -1) {
+            const int enable = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+            if(bind(fd, it->ai_addr, it->ai_addrlen) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+    if(info) {
+        freeaddrinfo(info);
+    }
+
+    return (fd != -1) ? net_socket(fd) : net_socket();
+}
+
+net_socket net_socket::connect(std::string_view address) {
+    if(address.starts_with(unix_prefix)) {
+        sockaddr_un unix_address;
+
+        if(!make_unix_address(address.substr(unix_prefix.size()), unix_address)) {
+            return {};
+        }
+
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if(fd == -1) {
+            return {};
+        }
+
+        if(::connect(fd, reinterpret_cast<sockaddr *>(&unix_address), sizeof(unix_address)) != 0) {
+            ::close(fd);
+            return {};
+        }
+
+        return net_socket(fd);
+    }
+
+    addrinfo *info = resolve_tcp_address(address, false);
+    int fd = -1;
+
+    for(addrinfo *it = info; it && fd == -1; it = it->ai_next) {
+        fd = ::socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+
+        if(fd != -1 && ::connect(fd, it->ai_addr, it->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    if(info) {
+        freeaddrinfo(info);
+    }
+
+    return (fd != -1) ? net_socket(fd) : net_socket();
+}
+
+bool net_socket::poll(std::span<const net_socket> sockets, std::span<u8> readable, u32 timeout_ms) {
+    std::vector<pollfd> fds(sockets.size());
+
+    for(size_t i = 0; i < sockets.size(); i++) {
+        fds[i] = {
+            .fd = static_cast<int>(sockets[i].handle_),
+            .events = POLLIN
+        };
+    }
+
+    if(::poll(fds.data(), fds.size(), static_cast<int>(timeout_ms)) < 0) {
+        return false;
+    }
+
+    for(size_t i = 0; i < sockets.size(); i++) {
+        readable[i] = (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) ? 1 : 0;
+    }
+
+    return true;
+}
+
+net_socket net_socket::accept() const {
+    const int fd = ::accept(static_cast<int>(handle_), nullptr, nullptr);
+    return (fd != -1) ? net_socket(fd) : net_socket();
+}
+
+bool net_socket::send_all(const void *data, size_t size) const {
+    const u8 *bytes = static_cast<const u8 *>(data);
+
+    while(size > 0) {
+        // A dead peer must show up as an error, not as SIGPIPE
+        const ssize_t sent = send(static_cast<int>(handle_), bytes, size, MSG_NOSIGNAL);
+
+        if(sent <= 0) {
+            return false;
+        }
+
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+
+    return true;
+}
+
+bool net_socket::receive_all(void *data, size_t size) const {
+    u8 *bytes = static_cast<u8 *>(data);
+
+    while(size > 0) {
+        const ssize_t received = recv(static_cast<int>(handle_), bytes, size, 0);
+
+        if(received <= 0) {
+            return false;
+        }
+
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+
+    return true;
+}
+
+void net_socket::set_receive_timeout(u32 timeout_ms) const {
+    const timeval timeout = {
+        .tv_sec = static_cast<time_t>(timeout_ms / 1000),
+        .tv_usec = static_cast<suseconds_t>((timeout_ms % 1000) * 1000)
+    };
+
+    setsockopt(static_cast<int>(handle_), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+void net_socket::close() {
+    if(is_valid()) {
+        ::close(static_cast<int>(handle_));
+        handle_ = invalid_handle;
+    }
+}
+
+}
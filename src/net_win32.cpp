@@ -0,0 +1,185 @@
+#include "net.h"
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "common_win32.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+    constexpr std::string_view unix_prefix = "unix:";
+    constexpr std::string_view tcp_prefix = "tcp:";
+
+    addrinfo * resolve_tcp_address(std::string_view address, bool passive) {
+        if(address.starts_with(tcp_prefix)) {
+            address.remove_prefix(tcp_prefix.size());
+        }
+
+        const size_t separator = address.rfind(':');
+
+        if(separator == std::string_view::npos) {
+            return nullptr;
+        }
+
+        const std::string host(address.substr(0, separator));
+        const std::string port(address.substr(separator + 1));
+
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+        addrinfo *result = nullptr;
+        const bool any_host = host.empty() || host == "*";
+
+        if(getaddrinfo(any_host ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0) {
+            return nullptr;
+        }
+
+        return result;
+    }
+}
+
+namespace ae {
+
+bool net_socket::startup() {
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+}
+
+void net_socket::shutdown() {
+    WSACleanup();
+}
+
+net_socket net_socket::listen(std::string_view address) {
+    // Unix domain sockets are only supported on Linux
+    if(address.starts_with(unix_prefix)) {
+        return {};
+    }
+
+    addrinfo *info = resolve_tcp_address(address, true);
+    SOCKET s = INVALID_SOCKET;
+
+    for(addrinfo *it = info; it && s == INVALID_SOCKET; it = it->ai_next) {
+        s = ::socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+
+        if(s != INVALID_SOCKET) {
+            if(bind(s, it->ai_addr, static_cast<int>(it->ai_addrlen)) != 0 || ::listen(s, SOMAXCONN) != 0) {
+                closesocket(s);
+                s = INVALID_SOCKET;
+            }
+        }
+    }
+
+    if(info) {
+        freeaddrinfo(info);
+    }
+
+    return (s != INVALID_SOCKET) ? net_socket(static_cast<intptr_t>(s)) : net_socket();
+}
+
+net_socket net_socket::connect(std::string_view address) {
+    if(address.starts_with(unix_prefix)) {
+        return {};
+    }
+
+    addrinfo *info = resolve_tcp_address(address, false);
+    SOCKET s = INVALID_SOCKET;
+
+    for(addrinfo *it = info; it && s == INVALID_SOCKET; it = it->ai_next) {
+        s = ::socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+
+        if(s != INVALID_SOCKET && ::connect(s, it->ai_addr, static_cast<int>(it->ai_addrlen)) != 0) {
+            closesocket(s);
+            s = INVALID_SOCKET;
+        }
+    }
+
+    if(info) {
+        freeaddrinfo(info);
+    }
+
+    return (s != INVALID_SOCKET) ? net_socket(static_cast<intptr_t>(s)) : net_socket();
+}
+
+bool net_socket::poll(std::span<const net_socket> sockets, std::span<u8> readable, u32 timeout_ms) {
+    std::vector<WSAPOLLFD> fds(sockets.size());
+
+    for(size_t i = 0; i < sockets.size(); i++) {
+        fds[i] = {
+            .fd = static_cast<SOCKET>(sockets[i].handle_),
+            .events = POLLRDNORM
+        };
+    }
+
+    if(WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), static_cast<INT>(timeout_ms)) == SOCKET_ERROR) {
+        return false;
+    }
+
+    for(size_t i = 0; i < sockets.size(); i++) {
+        readable[i] = (fds[i].revents & (POLLRDNORM | POLLHUP | POLLERR)) ? 1 : 0;
+    }
+
+    return true;
+}
+
+net_socket net_socket::accept() const {
+    const SOCKET s = ::accept(static_cast<SOCKET>(handle_), nullptr, nullptr);
+    return (s != INVALID_SOCKET) ? net_socket(static_cast<intptr_t>(s)) : net_socket();
+}
+
+bool net_socket::send_all(const void *data, size_t size) const {
+    const char *bytes = static_cast<const char *>(data);
+
+    while(size > 0) {
+        const int chunk = static_cast<int>((size > 0x40000000) ? 0x40000000 : size);
+        const int sent = send(static_cast<SOCKET>(handle_), bytes, chunk, 0);
+
+        if(sent <= 0) {
+            return false;
+        }
+
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+
+    return true;
+}
+
+bool net_socket::receive_all(void *data, size_t size) const {
+    char *bytes = static_cast<char *>(data);
+
+    while(size > 0) {
+        const int chunk = static_cast<int>((size > 0x40000000) ? 0x40000000 : size);
+        const int received = recv(static_cast<SOCKET>(handle_), bytes, chunk, 0);
+
+        if(received <= 0) {
+            return false;
+        }
+
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+
+    return true;
+}
+
+void net_socket::set_receive_timeout(u32 timeout_ms) const {
+    const DWORD timeout = timeout_ms;
+    setsockopt(static_cast<SOCKET>(handle_),
+               SOL_SOCKET,
+               SO_RCVTIMEO,
+               reinterpret_cast<const char *>(&timeout),
+               sizeof(timeout));
+}
+
+void net_socket::close() {
+    if(is_valid()) {
+        closesocket(static_cast<SOCKET>(handle_));
+        handle_ = invalid_handle;
+    }
+}
+
+}
@@ -2,26 +2,220 @@
 
 #include "raytracer.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
 #include <cstring>
+#include <utility>
+#include <vector>
 
 namespace ae {
 
-size_t output::file_size() {
+output::output(std::string_view file_name)
+    : output(file_name, default_layout()) {}
+
+output::image_layout output::default_layout() {
     auto [w, h] = raytracer::get_resolution();
-    return sizeof(tga_file_header) * (w * h * sizeof(u32));
+    const raytracer::region region = raytracer::get_region();
+
+    return {
+        .width_ = region.width_,
+        .height_ = region.height_,
+        .x_ = region.x_,
+        .y_ = region.y_,
+        .frame_width_ = w,
+        .frame_height_ = h
+    };
 }
 
-void output::write_default_header(void *buffer) {
-    auto [w, h] = raytracer::get_resolution();
+bool output::fits(const image_layout &layout) {
+    constexpr u32 limit = 0xffff;
+
+    return layout.width_ > 0
+        && layout.height_ > 0
+        && layout.width_ <= limit
+        && layout.height_ <= limit
+        && layout.x_ <= limit
+        && layout.y_ <= limit;
+}
 
+size_t output::header_size(const image_layout &layout) {
+    return sizeof(tga_file_header) + (layout.is_partial() ? sizeof(partial_image_id) : 0);
+}
+
+size_t output::file_size(const image_layout &layout) {
+    return header_size(layout) + (static_cast<size_t>(layout.width_) * layout.height_ * sizeof(u32));
+}
+
+void output::write_header(void *buffer, const image_layout &layout) {
     tga_file_header header = {
         .image_type_ = 2,
-        .width_ = static_cast<u16>(w),
-        .height_ = static_cast<u16>(h),
+        .x_origin_ = static_cast<u16>(layout.x_),
+        .y_origin_ = static_cast<u16>(layout.y_),
+        .width_ = static_cast<u16>(layout.width_),
+        .height_ = static_cast<u16>(layout.height_),
         .pixel_depth_ = 32
     };
 
+    if(layout.is_partial()) {
+        header.id_length_ = sizeof(partial_image_id);
+
+        const partial_image_id id = {
+            .magic_ = partial_image_magic,
+            .x_ = layout.x_,
+            .y_ = layout.y_,
+            .frame_width_ = layout.frame_width_,
+            .frame_height_ = layout.frame_height_
+        };
+
+        std::memcpy(static_cast<u8 *>(buffer) + sizeof(header), &id, sizeof(id));
+    }
+
     std::memcpy(buffer, &header, sizeof(header));
 }
 
+bool output::read_image(std::string_view file_name, std::vector<u32> &pixels, image_layout &layout) {
+    std::FILE *file = std::fopen(std::string(file_name).c_str(), "rb");
+
+    if(!file) {
+        return false;
+    }
+
+    tga_file_header header;
+
+    bool valid = std::fread(&header, sizeof(header), 1, file) == 1
+        && header.image_type_ == 2
+        && header.pixel_depth_ == 32
+        && std::fseek(file, header.id_length_, SEEK_CUR) == 0;
+
+    if(valid) {
+        layout = {
+            .width_ = header.width_,
+            .height_ = header.height_,
+            .x_ = header.x_origin_,
+            .y_ = header.y_origin_,
+            .frame_width_ = header.width_,
+            .frame_height_ = header.height_
+        };
+
+        pixels.resize(static_cast<size_t>(layout.width_) * layout.height_);
+        valid = std::fread(pixels.data(), sizeof(u32), pixels.size(), file) == pixels.size();
+    }
+
+    std::fclose(file);
+
+    return valid;
+}
+
+bool output::merge(std::span<const std::string> partial_file_names, std::string_view file_name) {
+    struct partial_image {
+        image_layout layout;
+        std::vector<u32> pixels;
+    };
+
+    std::vector<partial_image> partials;
+    partials.reserve(partial_file_names.size());
+
+    for(const std::string &partial_file_name : partial_file_names) {
+        std::FILE *file = std::fopen(partial_file_name.c_str(), "rb");
+
+        if(!file) {
+            return false;
+        }
+
+        tga_file_header header;
+        partial_image_id id;
+
+        const bool valid = std::fread(&header, sizeof(header), 1, file) == 1
+            && header.id_length_ == sizeof(partial_image_id)
+            && header.pixel_depth_ == 32
+            && std::fread(&id, sizeof(id), 1, file) == 1
+            && id.magic_ == partial_image_magic;
+
+        if(!valid) {
+            std::fclose(file);
+            return false;
+        }
+
+        partial_image partial = {
+            .layout = {
+                .width_ = header.width_,
+                .height_ = header.height_,
+                .x_ = id.x_,
+                .y_ = id.y_,
+                .frame_width_ = id.frame_width_,
+                .frame_height_ = id.frame_height_
+            }
+        };
+
+        partial.pixels.resize(static_cast<size_t>(partial.layout.width_) * partial.layout.height_);
+
+        const bool complete = std::fread(partial.pixels.data(),
+                                         sizeof(u32),
+                                         partial.pixels.size(),
+                                         file) == partial.pixels.size();
+        std::fclose(file);
+
+        if(!complete
+           || (partial.layout.x_ + partial.layout.width_) > partial.layout.frame_width_
+           || (partial.layout.y_ + partial.layout.height_) > partial.layout.frame_height_
+           || (!partials.empty()
+               && (partials.front().layout.frame_width_ != partial.layout.frame_width_
+                   || partials.front().layout.frame_height_ != partial.layout.frame_height_))) {
+            return false;
+        }
+
+        partials.push_back(std::move(partial));
+    }
+
+    if(partials.empty()) {
+        return false;
+    }
+
+    const image_layout layout = {
+        .width_ = partials.front().layout.frame_width_,
+        .height_ = partials.front().layout.frame_height_,
+        .frame_width_ = partials.front().layout.frame_width_,
+        .frame_height_ = partials.front().layout.frame_height_
+    };
+
+    // A missing shard or crop would otherwise end up as black pixels in the frame
+    std::vector<bool> covered(static_cast<size_t>(layout.width_) * layout.height_);
+
+    for(const partial_image &partial : partials) {
+        for(u32 y = 0; y < partial.layout.height_; y++) {
+            const size_t row = static_cast<size_t>(partial.layout.y_ + y) * layout.width_ + partial.layout.x_;
+            std::fill_n(covered.begin() + static_cast<std::ptrdiff_t>(row), partial.layout.width_, true);
+        }
+    }
+
+    const size_t uncovered = static_cast<size_t>(std::count(covered.begin(), covered.end(), false));
+
+    if(uncovered > 0) {
+        std::fprintf(stderr,
+                     "The partial images leave %zu pixels of the %ux%u frame uncovered\n",
+                     uncovered,
+                     layout.width_,
+                     layout.height_);
+        return false;
+    }
+
+    ae::output merged(file_name, layout);
+    u32 *pixels = static_cast<u32 *>(merged.get_buffer());
+
+    if(!pixels) {
+        return false;
+    }
+
+    for(const partial_image &partial : partials) {
+        for(u32 y = 0; y < partial.layout.height_; y++) {
+            std::memcpy(pixels + static_cast<size_t>(partial.layout.y_ + y) * layout.width_ + partial.layout.x_,
+                        partial.pixels.data() + static_cast<size_t>(y) * partial.layout.width_,
+                        partial.layout.width_ * sizeof(u32));
+        }
+    }
+
+    return true;
+}
+
 }
@@ -2,18 +2,51 @@
 
 #include "common.h"
 
+#include <span>
+#include <string>
 #include <string_view>
+#include <vector>
 
 namespace ae {
     class output {
     public:
+        // Placement of an image inside the frame it belongs to. Partial images (crops and shards)
+        // record their offset and the full frame size, so they can be merged afterwards.
+        struct image_layout {
+            u32 width_ = 0;
+            u32 height_ = 0;
+            u32 x_ = 0;
+            u32 y_ = 0;
+            u32 frame_width_ = 0;
+            u32 frame_height_ = 0;
+
+            bool is_partial() const { return width_ != frame_width_ || height_ != frame_height_; }
+        };
+
+        // Uses the layout of the region being rendered
         output(std::string_view file_name);
+        output(std::string_view file_name, const image_layout &layout);
         ~output();
 
         void * get_buffer();
 
-        static size_t file_size();
-        static void write_default_header(void *buffer);
+        static image_layout default_layout();
+
+        // TGA stores sizes and origins in 16 bits, larger images need ae::tiled_output
+        static bool fits(const image_layout &layout);
+        static size_t header_size(const image_layout &layout);
+        static size_t file_size(const image_layout &layout);
+        static void write_header(void *buffer, const image_layout &layout);
+
+        // Writes a complete image to a temporary file and renames it over file_name,
+        // so readers never observe a partially written image
+        static bool write_snapshot(std::string_view file_name, const u32 *pixels, const image_layout &layout);
+
+        // Loads the pixels of an image written by this class, partial images with their own size and origin
+        static bool read_image(std::string_view file_name, std::vector<u32> &pixels, image_layout &layout);
+
+        // Stitches partial images back into one full frame
+        static bool merge(std::span<const std::string> partial_file_names, std::string_view file_name);
 
     private:
 #pragma pack(push, 1)
@@ -31,8 +64,20 @@ namespace ae {
             u8 pixel_depth_ = 0;
             u8 img_descriptor_ = 0;
         };
+
+        // Stored in the TGA image ID field of partial images
+        struct partial_image_id {
+            u32 magic_ = 0;
+            u32 x_ = 0;
+            u32 y_ = 0;
+            u32 frame_width_ = 0;
+            u32 frame_height_ = 0;
+        };
 #pragma pack(pop)
 
+        static constexpr u32 partial_image_magic = 0x49504541; // "AEPI"
+
+        image_layout layout_;
         void *impl_ = nullptr;
     };
 }
@@ -1,6 +1,13 @@
 #include "output.h"
 
 #include "common_linux.h"
+#include "memory.h"
+#include "stats.h"
+#include "system.h"
+#include "trace.h"
+
+#include <cstdio>
+#include <string>
 
 namespace ae {
 
@@ -9,7 +16,15 @@ struct linux_memory_mapped_file {
     int fd_ = -1;
 };
 
-output::output(std::string_view file_name) {
+output::output(std::string_view file_name, const image_layout &layout)
+    : layout_(layout) {
+    if(!fits(layout_)) {
+        return;
+    }
+
+    AE_TRACE_SCOPE("output create");
+    const u64 start_time = ae::system_time_ns();
+
     int fd = open(file_name.data(),
                   O_CREAT | O_TRUNC | O_RDWR,
                   0644);
@@ -18,30 +33,38 @@ output::output(std::string_view file_name) {
         linux_memory_mapped_file *memory_mapped_file = new linux_memory_mapped_file();
         memory_mapped_file->fd_ = fd;
 
-        const size_t size = file_size();
+        const size_t size = file_size(layout_);
         ftruncate(memory_mapped_file->fd_, size);
 
-        memory_mapped_file->mapping_ = mmap(nullptr,
-                                            size,
-                                            PROT_READ | PROT_WRITE,
-                                            MAP_SHARED,
-                                            memory_mapped_file->fd_,
-                                            0);
+        void *mapping = mmap(nullptr,
+                             size,
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED,
+                             memory_mapped_file->fd_,
+                             0);
+
+        memory_mapped_file->mapping_ = (mapping != MAP_FAILED) ? mapping : nullptr;
 
         if(memory_mapped_file->mapping_) {
-            write_default_header(memory_mapped_file->mapping_);
+            write_header(memory_mapped_file->mapping_, layout_);
+            ae::memory_allocated(ae::memory_category::framebuffer, size);
         }
 
         impl_ = memory_mapped_file;
     }
+
+    ae::stats_record("output", "create", ae::stats_elapsed_ms(start_time));
 }
 
 output::~output() {
+    AE_TRACE_SCOPE("output writeback");
+
     if(impl_) {
         linux_memory_mapped_file *memory_mapped_file = reinterpret_cast<linux_memory_mapped_file *>(impl_);
 
         if(memory_mapped_file->mapping_) {
-            munmap(memory_mapped_file->mapping_, file_size());
+            munmap(memory_mapped_file->mapping_, file_size(layout_));
+            ae::memory_freed(ae::memory_category::framebuffer, file_size(layout_));
         }
 
         if(memory_mapped_file->fd_ != -1) {
@@ -53,13 +76,67 @@ output::~output() {
 }
 
 void * output::get_buffer() {
-    if(impl_) {
+    if(impl_ && reinterpret_cast<linux_memory_mapped_file *>(impl_)->mapping_) {
         linux_memory_mapped_file *memory_mapped_file = reinterpret_cast<linux_memory_mapped_file *>(impl_);
         return reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(memory_mapped_file->mapping_)
-                                        + sizeof(tga_file_header));
+                                        + header_size(layout_));
     }
 
     return nullptr;
 }
 
+bool output::write_snapshot(std::string_view file_name, const u32 *pixels, const image_layout &layout) {
+    AE_TRACE_SCOPE("write_snapshot");
+
+    if(!fits(layout)) {
+        return false;
+    }
+
+    const std::string path(file_name);
+    const std::string temp_path = path + ".tmp";
+
+    int fd = open(temp_path.c_str(),
+                  O_CREAT | O_TRUNC | O_WRONLY,
+                  0644);
+
+    if(fd == -1) {
+        return false;
+    }
+
+    u8 header[sizeof(tga_file_header) + sizeof(partial_image_id)];
+    write_header(header, layout);
+
+    const size_t header_bytes = header_size(layout);
+    const size_t pixels_size = file_size(layout) - header_bytes;
+
+    auto write_all = [fd](const void *data, size_t size) {
+        const u8 *bytes = static_cast<const u8 *>(data);
+
+        while(size > 0) {
+            const ssize_t written = write(fd, bytes, size);
+
+            if(written <= 0) {
+                return false;
+            }
+
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+
+        return true;
+    };
+
+    const bool success = write_all(header, header_bytes)
+        && write_all(pixels, pixels_size);
+
+    close(fd);
+
+    if(!success || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
 }
@@ -1,8 +1,13 @@
 #include "output.h"
 
 #include "common_win32.h"
+#include "memory.h"
+#include "stats.h"
+#include "system.h"
+#include "trace.h"
 
 #include <cstring>
+#include <string>
 
 struct win32_mapping_data {
     HANDLE handle_ = INVALID_HANDLE_VALUE;
@@ -12,7 +17,15 @@ struct win32_mapping_data {
 
 namespace ae {
 
-output::output(std::string_view file_name) {
+output::output(std::string_view file_name, const image_layout &layout)
+    : layout_(layout) {
+    if(!fits(layout_)) {
+        return;
+    }
+
+    AE_TRACE_SCOPE("output create");
+    const u64 start_time = ae::system_time_ns();
+
     HANDLE handle = CreateFileA(file_name.data(),
                                 GENERIC_READ | GENERIC_WRITE,
                                 FILE_SHARE_READ,
@@ -25,7 +38,7 @@ output::output(std::string_view file_name) {
         win32_mapping_data *file_data = new win32_mapping_data();
         file_data->handle_ = handle;
 
-        const size_t size = file_size();
+        const size_t size = file_size(layout_);
 
         file_data->mapping_ = CreateFileMappingA(handle,
                                                  nullptr,
@@ -42,20 +55,26 @@ output::output(std::string_view file_name) {
                                              size);
 
             if(file_data->view_) {
-                write_default_header(file_data->view_);
+                write_header(file_data->view_, layout_);
+                ae::memory_allocated(ae::memory_category::framebuffer, size);
             }
         }
 
         impl_ = file_data;
     }
+
+    ae::stats_record("output", "create", ae::stats_elapsed_ms(start_time));
 }
 
 output::~output() {
+    AE_TRACE_SCOPE("output writeback");
+
     if(impl_) {
         win32_mapping_data *file_data = reinterpret_cast<win32_mapping_data *>(impl_);
 
         if(file_data->view_) {
             UnmapViewOfFile(file_data->view_);
+            ae::memory_freed(ae::memory_category::framebuffer, file_size(layout_));
         }
 
         if(file_data->mapping_ != INVALID_HANDLE_VALUE) {
@@ -74,10 +93,69 @@ void * output::get_buffer() {
     if(impl_) {
         win32_mapping_data *data = reinterpret_cast<win32_mapping_data *>(impl_);
         return reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(data->view_)
-                                        + sizeof(tga_file_header));
+                                        + header_size(layout_));
     }
 
     return nullptr;
 }
 
+bool output::write_snapshot(std::string_view file_name, const u32 *pixels, const image_layout &layout) {
+    AE_TRACE_SCOPE("write_snapshot");
+
+    if(!fits(layout)) {
+        return false;
+    }
+
+    const std::string path(file_name);
+    const std::string temp_path = path + ".tmp";
+
+    HANDLE handle = CreateFileA(temp_path.c_str(),
+                                GENERIC_WRITE,
+                                0,
+                                nullptr,
+                                CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL,
+                                nullptr);
+
+    if(handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    u8 header[sizeof(tga_file_header) + sizeof(partial_image_id)];
+    write_header(header, layout);
+
+    const size_t header_bytes = header_size(layout);
+    const size_t pixels_size = file_size(layout) - header_bytes;
+
+    auto write_all = [handle](const void *data, size_t size) {
+        const u8 *bytes = static_cast<const u8 *>(data);
+
+        while(size > 0) {
+            const DWORD chunk = static_cast<DWORD>((size > 0x40000000) ? 0x40000000 : size);
+            DWORD written = 0;
+
+            if(!WriteFile(handle, bytes, chunk, &written, nullptr) || written == 0) {
+                return false;
+            }
+
+            bytes += written;
+            size -= written;
+        }
+
+        return true;
+    };
+
+    const bool success = write_all(header, header_bytes)
+        && write_all(pixels, pixels_size);
+
+    CloseHandle(handle);
+
+    if(!success || !MoveFileExA(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileA(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
 }
@@ -0,0 +1,83 @@
+#include "perf_counters.h"
+
+#include "stats.h"
+
+#include <string>
+
+namespace ae {
+
+perf_phase::perf_phase(std::string_view name)
+    : name_(name) {
+    if(perf_counters_enabled()) {
+        begin_ = perf_counters_read();
+        active_ = true;
+    }
+}
+
+perf_phase::~perf_phase() {
+    finish();
+}
+
+void perf_phase::finish(u64 rays) {
+    if(!active_) {
+        return;
+    }
+
+    active_ = false;
+
+    const perf_sample end = perf_counters_read();
+    const std::string section = "perf " + std::string(name_);
+
+    auto delta = [this, &end](perf_event event) {
+        const u32 index = static_cast<u32>(event);
+        return static_cast<f64>(end.values_[index] - begin_.values_[index]);
+    };
+
+    const f64 cycles = delta(perf_event::cycles);
+
+    if(perf_counters_available(perf_event::cycles)) {
+        ae::stats_record(section, "cycles", cycles, "");
+    }
+
+    if(perf_counters_available(perf_event::instructions)) {
+        ae::stats_record(section, "instructions", delta(perf_event::instructions), "");
+
+        if(perf_counters_available(perf_event::cycles) && cycles > 0.0) {
+            ae::stats_record(section, "ipc", delta(perf_event::instructions) / cycles, "");
+        }
+    }
+
+    // Low IPC with many misses per ray means the phase waits on memory, otherwise on execution
+    constexpr struct {
+        perf_event event;
+        const char *name;
+    } misses[] = {
+        { perf_event::l1d_misses, "l1d_misses" },
+        { perf_event::llc_misses, "llc_misses" },
+        { perf_event::branch_misses, "branch_misses" }
+    };
+
+    for(const auto &miss : misses) {
+        if(!perf_counters_available(miss.event)) {
+            continue;
+        }
+
+        ae::stats_record(section, miss.name, delta(miss.event), "");
+
+        if(rays > 0) {
+            ae::stats_record(section, std::string(miss.name) + "_per_ray", delta(miss.event) / static_cast<f64>(rays), "");
+        }
+    }
+
+    if(cycles > 0.0) {
+        if(perf_counters_available(perf_event::stalled_cycles_frontend)) {
+            ae::stats_record(section, "stalled_frontend", 100.0 * delta(perf_event::stalled_cycles_frontend) / cycles, "%");
+        }
+
+        if(perf_counters_available(perf_event::stalled_cycles_backend)) {
+            ae::stats_record(section, "stalled_backend", 100.0 * delta(perf_event::stalled_cycles_backend) / cycles, "%");
+        }
+    }
+}
+
+}
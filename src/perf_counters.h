@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common.h"
+
+#include <string_view>
+
+namespace ae {
+    enum class perf_event : u32 {
+        cycles,
+        instructions,
+        l1d_misses,
+        llc_misses,
+        branch_misses,
+        stalled_cycles_frontend,
+        stalled_cycles_backend,
+        count
+    };
+
+    struct perf_sample {
+        u64 values_[static_cast<u32>(perf_event::count)] = {};
+    };
+
+    // Hardware counters with --perf-counters (perf_event_open on Linux). They are opened on first use and
+    // count the opening thread and every thread it starts afterwards, in user mode only. Counters the CPU,
+    // the kernel or a container doesn't allow are left out, false if no counter could be opened at all.
+    bool perf_counters_enabled();
+    bool perf_counters_available(perf_event event);
+    perf_sample perf_counters_read();
+
+    // Counters of one phase of a render, recorded into the stats under "perf <name>" once finished.
+    // Does nothing unless perf_counters_enabled().
+    class perf_phase {
+    public:
+        perf_phase(std::string_view name);
+        ~perf_phase();
+
+        // rays traced during the phase, for the per-ray rates
+        void finish(u64 rays = 0);
+
+    private:
+        std::string_view name_;
+        perf_sample begin_;
+        bool active_ = false;
+    };
+}
@@ -0,0 +1,118 @@
+#include "perf_counters.h"
+
+#include "commands.h"
+#include "common_linux.h"
+#include "stats.h"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+namespace {
+    constexpr u32 event_count = static_cast<u32>(ae::perf_event::count);
+
+    struct perf_counter_files {
+        int fds_[event_count];
+        bool opened_ = false;
+        bool enabled_ = false;
+
+        perf_counter_files() {
+            for(int &fd : fds_) {
+                fd = -1;
+            }
+        }
+
+        ~perf_counter_files() {
+            for(int fd : fds_) {
+                if(fd != -1) {
+                    close(fd);
+                }
+            }
+        }
+    };
+
+    perf_counter_files perf_files;
+
+    constexpr u64 cache_miss(u64 cache) {
+        return cache
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    // In the order of ae::perf_event
+    constexpr struct {
+        u32 type;
+        u64 config;
+    } perf_event_configs[event_count] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D) },
+        { PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND }
+    };
+
+    int open_counter(u32 type, u64 config) {
+        perf_event_attr attr = {};
+        attr.type = type;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.inherit = 1; // Threads started later count into this counter once they exit
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        // Fails with EACCES under a strict perf_event_paranoid, ENOENT for events the CPU doesn't have
+        // and ENOSYS where seccomp filters the syscall, as in many containers
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    }
+}
+
+namespace ae {
+
+bool perf_counters_enabled() {
+    if(!perf_files.opened_) {
+        perf_files.opened_ = true;
+
+        if(!std::get<bool>(ae::command_handler::get().value("perf-counters"_hash))) {
+            return false;
+        }
+
+        u32 open_count = 0;
+
+        for(u32 i = 0; i < event_count; i++) {
+            perf_files.fds_[i] = open_counter(perf_event_configs[i].type, perf_event_configs[i].config);
+            open_count += (perf_files.fds_[i] != -1) ? 1 : 0;
+        }
+
+        ae::stats_record("perf", "open_counters", open_count, "");
+        perf_files.enabled_ = open_count > 0;
+    }
+
+    return perf_files.enabled_;
+}
+
+bool perf_counters_available(perf_event event) {
+    return perf_files.fds_[static_cast<u32>(event)] != -1;
+}
+
+perf_sample perf_counters_read() {
+    perf_sample sample;
+
+    for(u32 i = 0; i < event_count; i++) {
+        u64 values[3]; // Count, time enabled, time running
+
+        if(perf_files.fds_[i] == -1 || read(perf_files.fds_[i], values, sizeof(values)) != sizeof(values)) {
+            continue;
+        }
+
+        // Scaled up if the kernel had to multiplex more counters than the CPU has
+        sample.values_[i] = (values[2] > 0 && values[2] < values[1])
+            ? static_cast<u64>(static_cast<f64>(values[0]) * static_cast<f64>(values[1]) / static_cast<f64>(values[2]))
+            : values[0];
+    }
+
+    return sample;
+}
+
+}
@@ -0,0 +1,28 @@
+#include "perf_counters.h"
+
+#include "commands.h"
+#include "stats.h"
+
+namespace ae {
+
+// Windows only exposes hardware counters through ETW with administrator rights, so none are opened
+bool perf_counters_enabled() {
+    static bool reported = false;
+
+    if(!reported && std::get<bool>(ae::command_handler::get().value("perf-counters"_hash))) {
+        ae::stats_record("perf", "open_counters", 0, "");
+        reported = true;
+    }
+
+    return false;
+}
+
+bool perf_counters_available(perf_event) {
+    return false;
+}
+
+perf_sample perf_counters_read() {
+    return {};
+}
+
+}
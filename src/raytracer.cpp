@@ -1,20 +1,67 @@
 #include "raytracer.h"
 
+#include "aemath.h"
 #include "commands.h"
 
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
 namespace {
     u32 raytracer_width = 0;
     u32 raytracer_height = 0;
+
+    bool raytracer_region_valid = false;
+    ae::raytracer::region raytracer_region;
+
+    // Parses exactly "count" unsigned integers separated by "separator"
+    bool parse_u32_list(const std::string &str, char separator, u32 *values, u32 count) {
+        const char *cursor = str.c_str();
+
+        for(u32 i = 0; i < count; i++) {
+            char *end;
+            const unsigned long value = std::strtoul(cursor, &end, 10);
+
+            if(end == cursor || value > static_cast<u32>(-1)) {
+                return false;
+            }
+
+            values[i] = static_cast<u32>(value);
+
+            if(i + 1 < count) {
+                if(*end != separator) {
+                    return false;
+                }
+
+                cursor = end + 1;
+            } else if(*end != '\0') {
+                return false;
+            }
+        }
+
+        return true;
+    }
 }
 
 ae::color ae::raytracer::background0 = ae::color(1.0f, 1.0f, 1.0f);
 ae::color ae::raytracer::background1 = ae::color(AE_RGB(0x4d, 0xa6, 0xf0));
 ae::vec4f ae::raytracer::camera_pos(0.0f, 0.0f, 1.0f);
 ae::sphere ae::raytracer::sphere(ae::vec4f(0.0f, 0.0f, -2.0f), 1.0f);
+ae::vec4f ae::raytracer::scene_offset;
 
 ae::raytracer::raytracer(u32 *buffer)
     : framebuffer_(buffer) {}
 
+void ae::raytracer::set_frame(u32 frame, u32 frame_count) {
+    // The scene bobs up and down once over the whole animation. It's moved as a whole, so the scene
+    // uploaded by the compute backend stays valid.
+    constexpr f32 two_pi = 6.28318530718f;
+    constexpr f32 amplitude = 0.25f;
+
+    const f32 t = (frame_count > 0) ? static_cast<f32>(frame % frame_count) / static_cast<f32>(frame_count) : 0.0f;
+    scene_offset.y_ = amplitude * std::sin(two_pi * t);
+}
+
 std::pair<u32, u32> ae::raytracer::get_resolution() {
     if(raytracer_width > 0 && raytracer_height > 0) {
         return std::make_pair(raytracer_width, raytracer_height);
@@ -32,3 +79,84 @@ std::pair<u32, u32> ae::raytracer::get_resolution() {
 
     return std::make_pair(raytracer_width, raytracer_height);
 }
+
+void ae::raytracer::set_resolution(u32 width, u32 height) {
+    raytracer_width = width;
+    raytracer_height = height;
+    raytracer_region_valid = false;
+}
+
+ae::raytracer::region ae::raytracer::get_region() {
+    if(raytracer_region_valid) {
+        return raytracer_region;
+    }
+
+    auto [width, height] = get_resolution();
+    ae::command_handler &commands = ae::command_handler::get();
+
+    ae::command_handler::variant crop = commands.value("crop"_hash);
+    ae::command_handler::variant shard = commands.value("shard"_hash);
+
+    region result = {
+        .width_ = width,
+        .height_ = height
+    };
+
+    if(std::holds_alternative<std::string>(crop)) {
+        u32 values[4];
+
+        if(parse_u32_list(std::get<std::string>(crop), ',', values, AE_ARRAY_COUNT(values))
+           && values[0] < width && values[1] < height) {
+
+            // Grow the rectangle to whole tiles, the tracer never works on partial tiles
+            const u32 x0 = values[0] & ~(tile_size - 1);
+            const u32 y0 = values[1] & ~(tile_size - 1);
+            const u32 x1 = ae::min((values[0] + values[2] + (tile_size - 1)) & ~(tile_size - 1), width);
+            const u32 y1 = ae::min((values[1] + values[3] + (tile_size - 1)) & ~(tile_size - 1), height);
+
+            result = {
+                .x_ = x0,
+                .y_ = y0,
+                .width_ = (x1 > x0) ? (x1 - x0) : 0,
+                .height_ = (y1 > y0) ? (y1 - y0) : 0
+            };
+        } else {
+            result = {};
+        }
+
+        if(result.width_ == 0 || result.height_ == 0) {
+            std::fprintf(stderr, "--crop %s has to be x,y,width,height of a non empty rectangle starting inside the %ux%u image\n",
+                         std::get<std::string>(crop).c_str(), width, height);
+        }
+    } else if(std::holds_alternative<std::string>(shard)) {
+        u32 values[2];
+
+        if(parse_u32_list(std::get<std::string>(shard), '/', values, AE_ARRAY_COUNT(values))
+           && values[1] > 0 && values[0] < values[1]) {
+
+            // Shards are horizontal bands of whole tile rows
+            const u64 tile_rows = height / tile_size;
+            const u32 first_row = static_cast<u32>((tile_rows * values[0]) / values[1]);
+            const u32 last_row = static_cast<u32>((tile_rows * (values[0] + 1)) / values[1]);
+
+            result = {
+                .x_ = 0,
+                .y_ = first_row * tile_size,
+                .width_ = width,
+                .height_ = (last_row - first_row) * tile_size
+            };
+        } else {
+            result = {};
+        }
+
+        if(result.height_ == 0) {
+            std::fprintf(stderr, "--shard %s has to be index/count with index below count and at most one shard per %u pixel tile row\n",
+                         std::get<std::string>(shard).c_str(), tile_size);
+        }
+    }
+
+    raytracer_region = result;
+    raytracer_region_valid = true;
+
+    return raytracer_region;
+}
@@ -17,13 +17,33 @@ namespace ae {
         static ae::color background1;
         static ae::vec4f camera_pos;
         static ae::sphere sphere;
+        static ae::vec4f scene_offset; // Animated translation of the whole test scene
+
+        struct region {
+            u32 x_ = 0;
+            u32 y_ = 0;
+            u32 width_ = 0;
+            u32 height_ = 0;
+        };
 
         static std::pair<u32, u32> get_resolution();
 
+        // Replaces --width/--height, the region is derived again on the next get_region()
+        static void set_resolution(u32 width, u32 height);
+
+        // Moves the test scene to the given point of its animation, frame 0 is the still image
+        static void set_frame(u32 frame, u32 frame_count);
+
+        // Part of the frame that gets traced (--crop/--shard), in full-frame pixels and aligned to tile_size.
+        // Camera math always uses the full resolution. An empty region means the options were invalid.
+        static region get_region();
+
         virtual ~raytracer() = default;
 
         virtual bool setup() = 0;
-        virtual void trace() = 0;
+
+        // False if the frame couldn't be traced completely
+        virtual bool trace() = 0;
 
     protected:
         raytracer() = default;
@@ -0,0 +1,299 @@
+#include "regress.h"
+
+#include "aemath.h"
+#include "commands.h"
+#include "output.h"
+#include "raytracer.h"
+#include "software_raytracer.h"
+#include "system.h"
+#include "vulkan_raytracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+    constexpr u32 warmup_runs = 1;
+    constexpr u32 measured_runs = 5;
+    constexpr u32 reference_size = 256;
+
+    constexpr u32 default_tolerance = 2; // Per 8 bit channel, compute devices round differently than the CPU
+    constexpr u32 default_threshold = 10; // Percent of the baseline frame time
+
+    // Options that would change what the reference scenes look like
+    constexpr struct {
+        ae::strhash key;
+        const char *cmd;
+    } image_options[] = {
+        { "crop"_hash, "--crop" },
+        { "shard"_hash, "--shard" },
+        { "spp"_hash, "--spp" },
+        { "time-budget"_hash, "--time-budget" },
+        { "checkpoint"_hash, "--checkpoint" },
+        { "checkpoint-interval"_hash, "--checkpoint-interval" },
+        { "resume"_hash, "--resume" },
+        { "heatmap"_hash, "--heatmap" },
+        { "cameras"_hash, "--cameras" },
+        { "frames"_hash, "--frames" }
+    };
+
+    // The scenes of the benchmark, small enough to keep the references in the repository
+    constexpr struct {
+        const char *name;
+        f32 camera_z;
+    } scenes[] = {
+        { "default", 1.0f },
+        { "wide", 0.25f },
+        { "narrow", 4.0f }
+    };
+
+    struct baseline_entry {
+        std::string backend_;
+        std::string scene_;
+        f64 median_ms_ = 0.0;
+    };
+
+    struct image_difference {
+        u32 max_difference_ = 0;
+        u64 mismatched_pixels_ = 0;
+    };
+
+    image_difference compare(const std::vector<u32> &image, const std::vector<u32> &reference, u32 tolerance) {
+        image_difference difference;
+
+        for(size_t i = 0; i < image.size(); i++) {
+            u32 pixel_difference = 0;
+
+            for(u32 shift = 0; shift < 32; shift += 8) {
+                const i32 a = static_cast<i32>((image[i] >> shift) & 0xff);
+                const i32 b = static_cast<i32>((reference[i] >> shift) & 0xff);
+
+                pixel_difference = ae::max(pixel_difference, static_cast<u32>((a > b) ? (a - b) : (b - a)));
+            }
+
+            difference.max_difference_ = ae::max(difference.max_difference_, pixel_difference);
+            difference.mismatched_pixels_ += (pixel_difference > tolerance) ? 1 : 0;
+        }
+
+        return difference;
+    }
+
+    // Median of measured_runs renders after warmup_runs, negative if a render failed
+    template<typename TRender>
+    f64 measure(TRender render) {
+        std::vector<f64> frame_times;
+
+        for(u32 run = 0; run < warmup_runs + measured_runs; run++) {
+            const u64 start = ae::system_time_ns();
+
+            if(!render()) {
+                return -1.0;
+            }
+
+            if(run >= warmup_runs) {
+                frame_times.push_back(static_cast<f64>(ae::system_time_ns() - start) / 1000000.0);
+            }
+        }
+
+        std::sort(frame_times.begin(), frame_times.end());
+
+        return frame_times[frame_times.size() / 2];
+    }
+
+    // One "<backend> <scene> <median ms>" per line
+    std::vector<baseline_entry> read_baseline(const std::string &file_name) {
+        std::vector<baseline_entry> entries;
+        std::FILE *file = std::fopen(file_name.c_str(), "r");
+
+        if(!file) {
+            return entries;
+        }
+
+        char backend[64];
+        char scene[64];
+        f64 median_ms;
+
+        while(std::fscanf(file, "%63s %63s %lf", backend, scene, &median_ms) == 3) {
+            entries.push_back({ .backend_ = backend, .scene_ = scene, .median_ms_ = median_ms });
+        }
+
+        std::fclose(file);
+
+        return entries;
+    }
+
+    const baseline_entry * find_baseline(const std::vector<baseline_entry> &entries, const char *backend, const char *scene) {
+        auto entry = std::find_if(entries.begin(), entries.end(), [backend, scene](const baseline_entry &e) {
+            return e.backend_ == backend && e.scene_ == scene;
+        });
+
+        return (entry != entries.end()) ? &*entry : nullptr;
+    }
+}
+
+namespace ae {
+
+bool run_regression() {
+    const ae::command_handler &cmdhandler = ae::command_handler::get();
+
+    for(const auto &option : image_options) {
+        // --resume is a flag that is always present, false unless given
+        const ae::command_handler::variant value = cmdhandler.value(option.key);
+
+        if(cmdhandler.has(option.key) && !(std::holds_alternative<bool>(value) && !std::get<bool>(value))) {
+            std::fprintf(stderr, "%s changes the reference images and can't be used with --regress\n", option.cmd);
+            return false;
+        }
+    }
+
+    const std::string directory = std::get<std::string>(cmdhandler.value("regress"_hash));
+    const bool update = std::get<bool>(cmdhandler.value("regress-update"_hash));
+    const bool update_images = std::get<bool>(cmdhandler.value("regress-update-images"_hash));
+
+    const ae::command_handler::variant tolerance_value = cmdhandler.value("regress-tolerance"_hash);
+    const u32 tolerance = std::holds_alternative<u32>(tolerance_value) ? std::get<u32>(tolerance_value) : default_tolerance;
+
+    const ae::command_handler::variant threshold_value = cmdhandler.value("regress-threshold"_hash);
+    const u32 threshold = std::holds_alternative<u32>(threshold_value) ? std::get<u32>(threshold_value) : default_threshold;
+
+    // Timings only compare on the machine that recorded them, so the baseline isn't kept with the references
+    const ae::command_handler::variant baseline_value = cmdhandler.value("regress-baseline"_hash);
+    const std::string baseline_path = std::holds_alternative<std::string>(baseline_value)
+        ? std::get<std::string>(baseline_value)
+        : std::string("regress_baseline.txt");
+
+    const std::vector<baseline_entry> baseline = update ? std::vector<baseline_entry>() : read_baseline(baseline_path);
+    std::vector<baseline_entry> timings;
+
+    const ae::vec4f default_camera = ae::raytracer::camera_pos;
+    const auto [default_width, default_height] = ae::raytracer::get_resolution();
+
+    ae::raytracer::set_resolution(reference_size, reference_size);
+    ae::raytracer::set_frame(0, 1);
+
+    const ae::output::image_layout layout = {
+        .width_ = reference_size,
+        .height_ = reference_size,
+        .frame_width_ = reference_size,
+        .frame_height_ = reference_size
+    };
+
+    std::vector<u32> image(static_cast<size_t>(reference_size) * reference_size);
+    bool success = true;
+
+    // Checks one rendered image and its timing, prints a line per backend and scene
+    auto check = [&](const char *backend, const char *scene, f64 median_ms) {
+        const std::string reference_path = directory + "/" + scene + ".tga";
+
+        if(median_ms < 0.0) {
+            std::printf("%-8s %-8s render failed\n", backend, scene);
+            return false;
+        }
+
+        timings.push_back({ .backend_ = backend, .scene_ = scene, .median_ms_ = median_ms });
+
+        // The CPU renders are the references, the compute device has to match them
+        if(update_images && std::strcmp(backend, "software") == 0
+           && !ae::output::write_snapshot(reference_path, image.data(), layout)) {
+
+            std::printf("%-8s %-8s reference not written to %s\n", backend, scene, reference_path.c_str());
+            return false;
+        }
+
+        std::vector<u32> reference;
+        ae::output::image_layout reference_layout;
+
+        if(!ae::output::read_image(reference_path, reference, reference_layout)
+           || reference_layout.width_ != reference_size
+           || reference_layout.height_ != reference_size) {
+
+            std::printf("%-8s %-8s no reference at %s\n", backend, scene, reference_path.c_str());
+            return false;
+        }
+
+        const image_difference difference = compare(image, reference, tolerance);
+        const baseline_entry *expected = update ? nullptr : find_baseline(baseline, backend, scene);
+
+        bool passed = difference.mismatched_pixels_ == 0;
+
+        std::printf("%-8s %-8s max diff %3u, %6llu pixels over tolerance, %8.3f ms",
+                    backend,
+                    scene,
+                    difference.max_difference_,
+                    static_cast<unsigned long long>(difference.mismatched_pixels_),
+                    median_ms);
+
+        if(expected && expected->median_ms_ > 0.0) {
+            const f64 change = 100.0 * (median_ms - expected->median_ms_) / expected->median_ms_;
+            passed = passed && change <= static_cast<f64>(threshold);
+
+            std::printf(" (baseline %.3f ms, %+.1f%%)", expected->median_ms_, change);
+        } else if(!update) {
+            std::printf(" (no baseline)");
+        }
+
+        std::printf("  %s\n", passed ? "ok" : "FAILED");
+
+        return passed;
+    };
+
+    for(const auto &scene : scenes) {
+        ae::raytracer::camera_pos = ae::vec4f(default_camera.x_, default_camera.y_, scene.camera_z);
+
+        const f64 median_ms = measure([&image]() {
+            ae::software_raytracer raytracer(image.data());
+
+            return raytracer.setup() && raytracer.trace();
+        });
+
+        success = check("software", scene.name, median_ms) && success;
+    }
+
+    // Lavapipe works for machines without a GPU, select it with VK_ICD_FILENAMES
+    bool compute_ran = false;
+
+    if(ae::vulkan_raytracer::init()) {
+        ae::vulkan_raytracer raytracer(nullptr);
+
+        if(raytracer.setup()) {
+            compute_ran = true;
+
+            for(const auto &scene : scenes) {
+                ae::raytracer::camera_pos = ae::vec4f(default_camera.x_, default_camera.y_, scene.camera_z);
+
+                const f64 median_ms = measure([&raytracer, &image]() {
+                    return raytracer.submit() && raytracer.collect(image.data());
+                });
+
+                success = check("compute", scene.name, median_ms) && success;
+            }
+        }
+    }
+
+    if(!compute_ran) {
+        std::printf("compute  no Vulkan device, skipped\n");
+    }
+
+    ae::raytracer::camera_pos = default_camera;
+    ae::raytracer::set_resolution(default_width, default_height);
+
+    if(update) {
+        std::FILE *file = std::fopen(baseline_path.c_str(), "w");
+
+        if(!file) {
+            return false;
+        }
+
+        for(const baseline_entry &entry : timings) {
+            std::fprintf(file, "%s %s %.3f\n", entry.backend_.c_str(), entry.scene_.c_str(), entry.median_ms_);
+        }
+
+        success = (std::fclose(file) == 0) && success;
+    }
+
+    return success;
+}
+
+}
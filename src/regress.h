@@ -0,0 +1,13 @@
+#pragma once
+
+#include "common.h"
+
+namespace ae {
+    // Renders the reference scenes on the CPU and on the compute device if there is one, compares every
+    // image against <dir>/<scene>.tga (bench/reference in the repository) with a per channel tolerance
+    // (--regress-tolerance) and the median frame times against the baseline of this machine
+    // (--regress-baseline). False if an image diverges or a backend got slower than the baseline by more than
+    // --regress-threshold percent. --regress-update records the baseline instead, --regress-update-images
+    // rewrites the references from the CPU renders. Options that change the rendered images are rejected.
+    bool run_regression();
+}
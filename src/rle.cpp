@@ -0,0 +1,95 @@
+#include "rle.h"
+
+#include <cstring>
+
+namespace ae {
+
+void rle_encode(std::span<const u32> pixels, std::vector<u8> &out) {
+    constexpr size_t max_packet_count = 128;
+
+    auto append_pixel = [&out](u32 pixel) {
+        const size_t offset = out.size();
+        out.resize(offset + sizeof(pixel));
+        std::memcpy(out.data() + offset, &pixel, sizeof(pixel));
+    };
+
+    auto run_length = [&pixels](size_t start) {
+        size_t end = start + 1;
+
+        while(end < pixels.size() && (end - start) < max_packet_count && pixels[end] == pixels[start]) {
+            end++;
+        }
+
+        return end - start;
+    };
+
+    size_t i = 0;
+
+    while(i < pixels.size()) {
+        const size_t run = run_length(i);
+
+        if(run > 1) {
+            out.push_back(static_cast<u8>(0x80 | (run - 1)));
+            append_pixel(pixels[i]);
+            i += run;
+            continue;
+        }
+
+        // Literal packets extend until the next run of at least two pixels
+        size_t literal_end = i + 1;
+
+        while(literal_end < pixels.size()
+              && (literal_end - i) < max_packet_count
+              && run_length(literal_end) < 2) {
+            literal_end++;
+        }
+
+        out.push_back(static_cast<u8>((literal_end - i) - 1));
+
+        for(size_t j = i; j < literal_end; j++) {
+            append_pixel(pixels[j]);
+        }
+
+        i = literal_end;
+    }
+}
+
+bool rle_decode(std::span<const u8> data, std::span<u32> pixels) {
+    size_t in = 0;
+    size_t out = 0;
+
+    while(in < data.size()) {
+        const u8 header = data[in++];
+        const size_t count = (header & 0x7f) + 1;
+
+        if(out + count > pixels.size()) {
+            return false;
+        }
+
+        if(header & 0x80) {
+            if(in + sizeof(u32) > data.size()) {
+                return false;
+            }
+
+            u32 pixel;
+            std::memcpy(&pixel, data.data() + in, sizeof(pixel));
+            in += sizeof(pixel);
+
+            for(size_t i = 0; i < count; i++) {
+                pixels[out++] = pixel;
+            }
+        } else {
+            if(in + count * sizeof(u32) > data.size()) {
+                return false;
+            }
+
+            std::memcpy(pixels.data() + out, data.data() + in, count * sizeof(u32));
+            in += count * sizeof(u32);
+            out += count;
+        }
+    }
+
+    return out == pixels.size();
+}
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "common.h"
+
+#include <span>
+#include <vector>
+
+namespace ae {
+    // Run-length coding of 32-bit pixels using TGA style packets: a one byte header whose high bit
+    // marks a run (one pixel repeated) or a literal packet, and whose low 7 bits hold the pixel count - 1.
+    // Rendered backgrounds are constant along each row, so they compress well.
+    void rle_encode(std::span<const u32> pixels, std::vector<u8> &out);
+
+    // Fails if the data is malformed or doesn't decode to exactly pixels.size() pixels
+    bool rle_decode(std::span<const u8> data, std::span<u32> pixels);
+}
@@ -0,0 +1,101 @@
+#include "scene.h"
+
+#include "raytracer.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace ae {
+
+scene scene::build_test_scene() {
+    scene result;
+
+    const u32 material = result.add_material(ae::color(1.0f, 1.0f, 1.0f));
+    result.add_sphere(ae::raytracer::sphere, material);
+    result.build_bvh();
+
+    return result;
+}
+
+u32 scene::add_material(const ae::color &albedo) {
+    materials_.push_back({ .albedo_ = ae::vec4f(albedo.r_, albedo.g_, albedo.b_) });
+    return static_cast<u32>(materials_.size() - 1);
+}
+
+void scene::add_sphere(const ae::sphere &sphere, u32 material) {
+    primitives_.push_back({
+        .sphere_ = ae::vec4f(sphere.center_.x_, sphere.center_.y_, sphere.center_.z_, sphere.radius_),
+        .material_ = material
+    });
+}
+
+void scene::build_bvh() {
+    nodes_.clear();
+    nodes_.reserve(primitives_.empty() ? 1 : (primitives_.size() * 2));
+    nodes_.push_back({});
+
+    build_node(0, 0, static_cast<u32>(primitives_.size()));
+}
+
+void scene::build_node(u32 node, u32 first, u32 count) {
+    constexpr f32 inf = std::numeric_limits<f32>::infinity();
+
+    f32 bounds_min[3] = { inf, inf, inf };
+    f32 bounds_max[3] = { -inf, -inf, -inf };
+    f32 centroid_min[3] = { inf, inf, inf };
+    f32 centroid_max[3] = { -inf, -inf, -inf };
+
+    for(u32 i = first; i < first + count; i++) {
+        const ae::vec4f &sphere = primitives_[i].sphere_;
+
+        for(u32 axis = 0; axis < 3; axis++) {
+            bounds_min[axis] = std::min(bounds_min[axis], sphere.v_[axis] - sphere.w_);
+            bounds_max[axis] = std::max(bounds_max[axis], sphere.v_[axis] + sphere.w_);
+            centroid_min[axis] = std::min(centroid_min[axis], sphere.v_[axis]);
+            centroid_max[axis] = std::max(centroid_max[axis], sphere.v_[axis]);
+        }
+    }
+
+    bvh_node result = {
+        .min_ = { bounds_min[0], bounds_min[1], bounds_min[2] },
+        .first_ = first,
+        .max_ = { bounds_max[0], bounds_max[1], bounds_max[2] },
+        .count_ = count
+    };
+
+    // An empty scene ends up as a single leaf with inverted bounds, which no ray can hit
+    if(count <= max_leaf_primitives) {
+        nodes_[node] = result;
+        return;
+    }
+
+    // Median split along the axis in which the centroids are spread out the most
+    u32 split_axis = 0;
+
+    for(u32 axis = 1; axis < 3; axis++) {
+        if((centroid_max[axis] - centroid_min[axis]) > (centroid_max[split_axis] - centroid_min[split_axis])) {
+            split_axis = axis;
+        }
+    }
+
+    const u32 left_count = count / 2;
+
+    std::nth_element(primitives_.begin() + first,
+                     primitives_.begin() + first + left_count,
+                     primitives_.begin() + first + count,
+                     [split_axis](const primitive &a, const primitive &b) {
+                         return a.sphere_.v_[split_axis] < b.sphere_.v_[split_axis];
+                     });
+
+    const u32 children = static_cast<u32>(nodes_.size());
+    nodes_.resize(nodes_.size() + 2);
+
+    result.first_ = children;
+    result.count_ = 0;
+    nodes_[node] = result;
+
+    build_node(children, first, left_count);
+    build_node(children + 1, first + left_count, count - left_count);
+}
+
+}
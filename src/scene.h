@@ -0,0 +1,60 @@
+#pragma once
+
+#include "color.h"
+#include "common.h"
+#include "memory.h"
+#include "shapes.h"
+#include "vec.h"
+
+#include <span>
+#include <vector>
+
+namespace ae {
+    // Flattened scene for the compute backend: primitives, their materials and a BVH over them.
+    // The structs match the storage buffer layouts in compute.hlsl and get uploaded as they are.
+    class scene {
+    public:
+        struct primitive {
+            ae::vec4f sphere_; // [x y z] = center, [w] = radius
+            u32 material_ = 0;
+            u32 padding_[3] = {};
+        };
+
+        struct material {
+            ae::vec4f albedo_; // [x y z] = rgb
+        };
+
+        // Interior nodes have their children at first_ and first_ + 1,
+        // leaves cover count_ primitives starting at first_
+        struct bvh_node {
+            f32 min_[3];
+            u32 first_;
+            f32 max_[3];
+            u32 count_; // 0 for interior nodes
+        };
+
+        static_assert(sizeof(primitive) == 32 && sizeof(material) == 16 && sizeof(bvh_node) == 32);
+
+        // The test scene of ae::raytracer, at rest
+        static scene build_test_scene();
+
+        u32 add_material(const ae::color &albedo);
+        void add_sphere(const ae::sphere &sphere, u32 material);
+
+        // Reorders the primitives, so that every leaf covers a contiguous range of them
+        void build_bvh();
+
+        std::span<const primitive> primitives() const { return primitives_; }
+        std::span<const material> materials() const { return materials_; }
+        std::span<const bvh_node> nodes() const { return nodes_; }
+
+    private:
+        static constexpr u32 max_leaf_primitives = 2;
+
+        void build_node(u32 node, u32 first, u32 count);
+
+        ae::tracked_vector<primitive, ae::memory_category::scene> primitives_;
+        ae::tracked_vector<material, ae::memory_category::scene> materials_;
+        ae::tracked_vector<bvh_node, ae::memory_category::acceleration> nodes_;
+    };
+}
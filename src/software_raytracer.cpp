@@ -2,10 +2,20 @@
 
 #include "aemath.h"
 #include "color.h"
+#include "commands.h"
+#include "output.h"
+#include "perf_counters.h"
+#include "random.h"
 #include "ray.h"
 #include "shapes.h"
+#include "stats.h"
+#include "system.h"
+#include "trace.h"
 #include "vec.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
 #include <utility>
 
 template<typename TType, auto TLockFunc, auto TUnlockFunc>
@@ -52,20 +62,43 @@ using ae_condition_variable = pthread_cond_t;
 static ae_mutex queue_mutex = AE_MUTEX_INITIALIZER;
 static ae_mutex next_tile_mutex = AE_MUTEX_INITIALIZER;
 static ae_condition_variable queue_ready_cv = AE_CONDITION_VARIABLE_INITIALIZER;
+static ae_condition_variable pass_ready_cv = AE_CONDITION_VARIABLE_INITIALIZER;
 
 static void ae_cond_wait(ae_condition_variable *cv, ae_mutex *mutex);
 static void cond_signal(ae_condition_variable *cv);
+static void cond_broadcast(ae_condition_variable *cv);
 
 #undef AE_CONDITION_VARIABLE_INITIALIZER
 #undef AE_MUTEX_INITIALIZER
 
+// Seeds are derived from the pass and tile alone, so a tile samples the same
+// positions no matter which thread ends up tracing it
+static u32 tile_seed(u32 seed, u32 pass, u32 row, u32 col) {
+    u32 hash = seed ^ (pass * 0x9e3779b9u) ^ (row * 0x85ebca6bu) ^ (col * 0xc2b2ae35u);
+    hash ^= hash >> 16;
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+    hash *= 0x846ca68bu;
+    hash ^= hash >> 16;
+
+    return (hash != 0) ? hash : 1; // ae::random treats 0 as a request for a random seed
+}
+
 namespace ae {
 
 software_raytracer::software_raytracer(u32 *buffer)
-    : raytracer(buffer) {
+    : software_raytracer(buffer, raytracer::get_region()) {
+}
+
+software_raytracer::software_raytracer(u32 *buffer, const ae::raytracer::region &region)
+    : raytracer(buffer)
+    , region_(region) {
 }
 
 bool software_raytracer::setup() {
+    AE_TRACE_SCOPE("software setup");
+    ae::perf_phase perf("software setup");
+
     auto [width, height] = raytracer::get_resolution();
     width_ = width;
     height_ = height;
@@ -84,51 +117,148 @@ bool software_raytracer::setup() {
                             viewport_size_.y_ / static_cast<f32>(height_),
                             0.0f);
 
-    row_count_ = width_ / ae::raytracer::tile_size;
-    col_count_ = height_ / ae::raytracer::tile_size;
+    if(region_.width_ == 0 || region_.height_ == 0) {
+        return false;
+    }
+
+    row_count_ = region_.width_ / ae::raytracer::tile_size;
+    col_count_ = region_.height_ / ae::raytracer::tile_size;
+
+    const ae::command_handler &cmdhandler = ae::command_handler::get();
+
+    const ae::command_handler::variant tile_order = cmdhandler.value("tile-order"_hash);
+    cost_order_ = !std::holds_alternative<std::string>(tile_order) || std::get<std::string>(tile_order) != "row";
+
+    // No tiles are handed out until the first pass begins
+    tile_order_.resize(static_cast<size_t>(row_count_) * col_count_);
+    std::iota(tile_order_.begin(), tile_order_.end(), 0u);
+    tile_estimates_.assign(cost_order_ ? tile_order_.size() : 0, 0);
+    next_tile_ = static_cast<u32>(tile_order_.size());
+
+    auto get_u32 = [&cmdhandler](ae::strhash key, u32 fallback) {
+        const ae::command_handler::variant value = cmdhandler.value(key);
+        return std::holds_alternative<u32>(value) ? std::get<u32>(value) : fallback;
+    };
+
+    time_budget_ns_ = get_u32("time-budget"_hash, 0) * 1000000000ull;
+    snapshot_interval_ns_ = get_u32("snapshot-interval"_hash, 0) * 1000000000ull;
+    checkpoint_interval_ns_ = get_u32("checkpoint-interval"_hash, 0) * 1000000000ull;
+    seed_ = get_u32("seed"_hash, 0);
+
+    // A time budget without an explicit sample count keeps refining until the budget runs out
+    target_spp_ = get_u32("spp"_hash, (time_budget_ns_ > 0) ? 0 : 1);
+
+    if(target_spp_ == 0 && time_budget_ns_ == 0) {
+        target_spp_ = 1;
+    }
+
+    const ae::command_handler::variant heatmap = cmdhandler.value("heatmap"_hash);
+
+    if(std::holds_alternative<std::string>(heatmap)) {
+        heatmap_path_ = std::get<std::string>(heatmap);
+        tile_costs_.assign(static_cast<size_t>(row_count_) * col_count_, tile_cost{});
+    }
+
+    const ae::command_handler::variant snapshot = cmdhandler.value("snapshot"_hash);
+    snapshot_path_ = std::holds_alternative<std::string>(snapshot)
+        ? std::get<std::string>(snapshot)
+        : std::string("snapshot.tga");
+
+    snapshot_layout_ = {
+        .width_ = region_.width_,
+        .height_ = region_.height_,
+        .x_ = region_.x_,
+        .y_ = region_.y_,
+        .frame_width_ = width_,
+        .frame_height_ = height_
+    };
+
+    const size_t pixel_count = static_cast<size_t>(region_.width_) * region_.height_;
+
+    const bool resume = std::get<bool>(cmdhandler.value("resume"_hash));
+    const ae::command_handler::variant checkpoint_path = cmdhandler.value("checkpoint"_hash);
+
+    if(resume || checkpoint_interval_ns_ > 0 || std::holds_alternative<std::string>(checkpoint_path)) {
+        checkpoint_ = std::make_unique<ae::checkpoint>(std::holds_alternative<std::string>(checkpoint_path)
+                                                           ? std::string_view(std::get<std::string>(checkpoint_path))
+                                                           : std::string_view("render.checkpoint"),
+                                                       resume,
+                                                       seed_);
+
+        if(!checkpoint_->is_valid()) {
+            return false;
+        }
+
+        accumulation_ = checkpoint_->accumulation();
+        sample_counts_ = checkpoint_->sample_counts();
+        seed_ = checkpoint_->seed();
+        first_pass_ = checkpoint_->completed_passes();
+
+        // The output file starts out empty, so bring it up to date with the restored state
+        for(size_t i = 0; i < pixel_count; i++) {
+            if(sample_counts_[i] > 0) {
+                resolve_pixel(i);
+            }
+        }
+
+        ae::system_catch_termination();
+    } else {
+        accumulation_storage_.assign(pixel_count, ae::vec4f());
+        sample_count_storage_.assign(pixel_count, 0);
+
+        accumulation_ = accumulation_storage_.data();
+        sample_counts_ = sample_count_storage_.data();
+    }
 
     return true;
 }
 
-void software_raytracer::trace() {
-    auto copy_to_framebuffer = [this](const tile_data &tile) {
-        const u32 ystart = tile.col * ae::raytracer::tile_size;
-        const u32 yend = ystart + ae::raytracer::tile_size;
+bool software_raytracer::trace() {
+    // Opened before the workers start, so their counts are included
+    ae::perf_phase trace_phase("software trace");
+    u64 traced_rays = 0;
 
-        const u32 xstart = tile.row * ae::raytracer::tile_size;
-        const u32 xend = xstart + ae::raytracer::tile_size;
+    const u64 start_time = ae::system_time_ns();
+    u64 last_snapshot_time = start_time;
+    u64 last_checkpoint_time = start_time;
 
-        u32 tile_index = 0;
+    auto write_snapshot_if_due = [this, &last_snapshot_time]() {
+        if(snapshot_interval_ns_ > 0) {
+            const u64 now = ae::system_time_ns();
 
-        for(u32 y = ystart; y < yend; y++) {
-            for(u32 x = xstart; x < xend; x++) {
-                framebuffer_[y * width_ + x] = tile.pixels[tile_index++];
+            if((now - last_snapshot_time) >= snapshot_interval_ns_) {
+                ae::output::write_snapshot(snapshot_path_, framebuffer_, snapshot_layout_);
+                last_snapshot_time = now;
             }
         }
     };
 
-    auto single_threaded_routine = [this, &copy_to_framebuffer]() {
-        tile_data tile;
+    auto flush_checkpoint = [this, &last_checkpoint_time](bool force) {
+        if(checkpoint_) {
+            const u64 now = ae::system_time_ns();
 
-        while(get_next_tile(tile)) {
-            trace_tile(tile);
-            copy_to_framebuffer(tile);
+            if(force || (checkpoint_interval_ns_ > 0 && (now - last_checkpoint_time) >= checkpoint_interval_ns_)) {
+                checkpoint_->flush();
+                last_checkpoint_time = now;
+            }
         }
     };
 
-    i32 thread_count = 0;
+    // The calling thread collects the tiles and only traces them itself if there are no workers
+    i32 thread_count = (requested_threads_ > 1)
+        ? static_cast<i32>(requested_threads_)
+        : ((requested_threads_ == 1) ? 0 : static_cast<i32>(ae::system_cpu_count()) - 1);
 
-#ifdef AE_PLATFORM_WIN32
-    SYSTEM_INFO sysinfo;
-    GetSystemInfo(&sysinfo);
+    thread_counters_.assign(static_cast<size_t>(thread_count) + 1, ray_counters{});
+    next_thread_counters_ = 1;
 
+#ifdef AE_PLATFORM_WIN32
     std::vector<HANDLE> threads;
 
-    if(sysinfo.dwNumberOfProcessors > 1) {
-        InitializeCriticalSectionAndSpinCount(&queue_mutex, 4000);
-        InitializeCriticalSectionAndSpinCount(&next_tile_mutex, 4000);
+    InitializeCriticalSectionAndSpinCount(&queue_mutex, 4000);
+    InitializeCriticalSectionAndSpinCount(&next_tile_mutex, 4000);
 
-        thread_count = static_cast<i32>(sysinfo.dwNumberOfProcessors - 1);
+    if(thread_count > 0) {
         threads.reserve(thread_count);
 
         for(i32 i = 0; i < thread_count; i++) {
@@ -142,50 +272,108 @@ void software_raytracer::trace() {
     }
 
 #elif defined(AE_PLATFORM_LINUX)
-    thread_count = static_cast<i32>(sysconf(_SC_NPROCESSORS_ONLN));
-
-    if(thread_count != -1) {
-        if(thread_count = ae::max<long>(0, thread_count - 1); thread_count > 0) {
-            pthread_attr_t attrib;
-            pthread_attr_init(&attrib);
-            pthread_attr_setdetachstate(&attrib, PTHREAD_CREATE_DETACHED);
-
-            for(u32 i = 0; i < thread_count; i++) {
-                pthread_t thread;
-                pthread_create(&thread,
-                               &attrib,
-                               software_raytracer::thread_func<void *>,
-                               this);
-            }
+    std::vector<pthread_t> threads;
+
+    if(thread_count > 0) {
+        threads.reserve(thread_count);
 
-            pthread_attr_destroy(&attrib);
+        for(i32 i = 0; i < thread_count; i++) {
+            pthread_t thread;
+
+            if(pthread_create(&thread,
+                              nullptr,
+                              software_raytracer::thread_func<void *>,
+                              this) == 0) {
+                threads.push_back(thread);
+            }
         }
     }
+
+    thread_count = static_cast<i32>(threads.size());
 #endif
 
-    if(thread_count > 0) {
-        for(;;) {
-            tile_data tile;
+    // The workers are still starting up meanwhile
+    if(cost_order_) {
+        estimate_tile_costs();
+    }
+
+    u64 pass_start_time = start_time;
+    u32 pass = first_pass_;
+    bool interrupted = false;
+    bool done = target_spp_ > 0 && pass >= target_spp_;
+
+    while(!done) {
+        const u32 pending_tiles = begin_pass(pass);
+
+        if(thread_count > 0) {
+            u32 tiles_to_collect = pending_tiles;
+
+            for(u32 i = 0; i < tiles_to_collect; i++) {
+                tile_data tile;
+
+                {
+                    AE_TRACE_SCOPE("wait for tile");
+                    ae_scoped_lock lock{&queue_mutex};
 
-            {
-                ae_scoped_lock lock{&queue_mutex};
+                    while(tile_queue_.empty()) {
+                        ae_cond_wait(&queue_ready_cv, &queue_mutex);
+                    }
 
-                while(tile_queue_.empty() && !finished_) {
-                    ae_cond_wait(&queue_ready_cv, &queue_mutex);
+                    tile = tile_queue_.front();
+                    tile_queue_.pop();
                 }
 
-                if(tile_queue_.empty() && finished_) {
-                    break;
+                accumulate_tile(tile);
+                traced_rays += ae::raytracer::tile_size * ae::raytracer::tile_size;
+                write_snapshot_if_due();
+                flush_checkpoint(false);
+
+                // Tiles that are already being traced still get collected, so the counts stay consistent
+                if(!interrupted && ae::system_termination_requested()) {
+                    interrupted = true;
+                    tiles_to_collect = stop_issuing();
                 }
+            }
+
+            ae_scoped_lock lock{&next_tile_mutex};
+
+            // How long threads sat idle waiting for the last tiles of the pass
+            if(drained_time_ > 0) {
+                ae::stats_record("software schedule", "pass_tail", ae::stats_elapsed_ms(drained_time_));
+            }
+        } else {
+            tile_data tile;
 
-                tile = tile_queue_.front();
-                tile_queue_.pop();
+            while(!interrupted && issue_tile(tile)) {
+                trace_tile(tile);
+                thread_counters_[0].add_tile(tile);
+                accumulate_tile(tile);
+                traced_rays += ae::raytracer::tile_size * ae::raytracer::tile_size;
+                write_snapshot_if_due();
+                flush_checkpoint(false);
+
+                interrupted = ae::system_termination_requested();
             }
+        }
+
+        const u64 now = ae::system_time_ns();
 
-            copy_to_framebuffer(tile);
+        if(!interrupted) {
+            pass++;
         }
-    } else {
-        single_threaded_routine();
+
+        if(checkpoint_) {
+            checkpoint_->set_completed_passes(pass);
+        }
+
+        done = interrupted || should_stop(pass, now - start_time, now - pass_start_time);
+        pass_start_time = now;
+    }
+
+    {
+        ae_scoped_lock lock{&next_tile_mutex};
+        finished_ = true;
+        cond_broadcast(&pass_ready_cv);
     }
 
 #ifdef AE_PLATFORM_WIN32
@@ -195,69 +383,367 @@ void software_raytracer::trace() {
         for(HANDLE h : threads) {
             CloseHandle(h);
         }
+    }
 
-        DeleteCriticalSection(&next_tile_mutex);
-        DeleteCriticalSection(&queue_mutex);
+    DeleteCriticalSection(&next_tile_mutex);
+    DeleteCriticalSection(&queue_mutex);
+#elif defined(AE_PLATFORM_LINUX)
+    for(pthread_t thread : threads) {
+        pthread_join(thread, nullptr);
     }
 #endif
+
+    trace_phase.finish(traced_rays);
+
+    counters_ = {};
+
+    for(const ray_counters &counters : thread_counters_) {
+        counters_.add(counters);
+    }
+
+    const f64 trace_seconds = static_cast<f64>(ae::system_time_ns() - start_time) / 1000000000.0;
+
+    ae::stats_record("software rays", "primary_rays", static_cast<f64>(counters_.primary_rays_), "");
+    ae::stats_record("software rays", "intersection_tests", static_cast<f64>(counters_.intersection_tests_), "");
+    ae::stats_record("software rays", "hits", static_cast<f64>(counters_.hits_), "");
+    ae::stats_record("software rays", "samples", static_cast<f64>(counters_.samples_), "");
+
+    if(trace_seconds > 0.0) {
+        ae::stats_record("software rays", "throughput", static_cast<f64>(counters_.primary_rays_) / trace_seconds, "rays/s");
+    }
+
+    if(counters_.primary_rays_ > 0) {
+        ae::stats_record("software rays",
+                         "tests_per_ray",
+                         static_cast<f64>(counters_.intersection_tests_) / static_cast<f64>(counters_.primary_rays_),
+                         "");
+    }
+
+    ae::perf_phase writeback_phase("software writeback");
+
+    flush_checkpoint(true);
+
+    if(snapshot_interval_ns_ > 0) {
+        ae::output::write_snapshot(snapshot_path_, framebuffer_, snapshot_layout_);
+    }
+
+    if(!heatmap_path_.empty()) {
+        write_heatmap();
+    }
+
+    return true;
+}
+
+ae::ray software_raytracer::camera_ray(f32 x, f32 y) const {
+    const ae::vec4f uv = (ae::vec4f(x, y, 0.0f) * pixel_size_) - (viewport_size_ * ae::vec4f(0.5f, 0.5f, 1.0f));
+
+    return ae::ray(ae::raytracer::camera_pos, uv - ae::raytracer::camera_pos);
 }
 
 void software_raytracer::trace_tile(tile_data &tile) {
+    AE_TRACE_SCOPE("trace_tile");
+
+    // Timing every tile isn't free at this granularity, so it only happens when someone looks at the results
+    const u64 start_time = tile_costs_.empty() ? 0 : ae::system_time_ns();
+
+    tile.intersection_tests = 0;
+    tile.hits = 0;
+
     const u32 xstart = tile.row * ae::raytracer::tile_size;
     const u32 ystart = tile.col * ae::raytracer::tile_size;
 
+    // The first pass samples pixel centers, every later pass jitters within the pixel
+    ae::random rng(tile_seed(seed_, tile.pass, tile.row, tile.col));
+    const bool jitter = tile.pass > 0;
+
+    const ae::sphere sphere(ae::raytracer::sphere.center_ + ae::raytracer::scene_offset, ae::raytracer::sphere.radius_);
+
     for(u32 y = 0; y < ae::raytracer::tile_size; y++) {
         const f32 yf = static_cast<f32>(y + ystart);
         const f32 t = yf / static_cast<f32>(height_);
 
-        const u32 background = ae::color(ae::lerp(t, ae::raytracer::background0.r_, ae::raytracer::background1.r_),
-                                         ae::lerp(t, ae::raytracer::background0.g_, ae::raytracer::background1.g_),
-                                         ae::lerp(t, ae::raytracer::background0.b_, ae::raytracer::background1.b_)).get_argb32();
+        const ae::color background(ae::lerp(t, ae::raytracer::background0.r_, ae::raytracer::background1.r_),
+                                   ae::lerp(t, ae::raytracer::background0.g_, ae::raytracer::background1.g_),
+                                   ae::lerp(t, ae::raytracer::background0.b_, ae::raytracer::background1.b_));
 
         for(u32 x = 0; x < ae::raytracer::tile_size; x++) {
-            const ae::vec4f uv = (ae::vec4f(static_cast<f32>(x + xstart) + 0.5f, yf + 0.5f, 0.0f) * pixel_size_)
-                - (viewport_size_ * ae::vec4f(0.5f, 0.5f, 1.0f));
+            const f32 dx = jitter ? rng.next_f32() : 0.5f;
+            const f32 dy = jitter ? rng.next_f32() : 0.5f;
 
-            const ae::ray ray(ae::raytracer::camera_pos, uv - ae::raytracer::camera_pos);
+            const ae::ray ray = camera_ray(static_cast<f32>(x + xstart) + dx, yf + dy);
             ae::ray_hit_info hit_info;
 
-            u32 *pixel = &tile.pixels[y * ae::raytracer::tile_size + x];
+            ae::color *sample = &tile.samples[y * ae::raytracer::tile_size + x];
+
+            tile.intersection_tests++;
+
+            if(sphere.intersects(ray, hit_info)) {
+                tile.hits++;
 
-            if(ae::raytracer::sphere.intersects(ray, hit_info)) {
                 const std::pair<f32, f32> input{-1.0f, 1.0f};
                 const std::pair<f32, f32> output{0.0f, 1.0f};
 
-                const ae::color c(ae::remap(hit_info.normal_.x_, input, output),
-                                  ae::remap(hit_info.normal_.y_, input, output),
-                                  ae::remap(hit_info.normal_.z_, input, output));
-
-                *pixel = c.get_argb32();
+                *sample = ae::color(ae::remap(hit_info.normal_.x_, input, output),
+                                    ae::remap(hit_info.normal_.y_, input, output),
+                                    ae::remap(hit_info.normal_.z_, input, output));
             } else {
-                *pixel = background;
+                *sample = background;
+            }
+        }
+    }
+
+    tile.trace_ns = tile_costs_.empty() ? 0 : (ae::system_time_ns() - start_time);
+}
+
+void software_raytracer::estimate_tile_costs() {
+    AE_TRACE_SCOPE("estimate tile costs");
+
+    // One probe ray through the center of every block of probe_tiles x probe_tiles tiles, which stands in
+    // for all of them. Costs are counted like trace_tile counts them, as intersection tests plus hits.
+    constexpr u32 probe_tiles = 4;
+    constexpr u64 rays_per_tile = ae::raytracer::tile_size * ae::raytracer::tile_size;
+
+    const ae::sphere sphere(ae::raytracer::sphere.center_ + ae::raytracer::scene_offset, ae::raytracer::sphere.radius_);
+
+    for(u32 col = 0; col < col_count_; col += probe_tiles) {
+        const u32 block_cols = ae::min(probe_tiles, col_count_ - col);
+
+        for(u32 row = 0; row < row_count_; row += probe_tiles) {
+            const u32 block_rows = ae::min(probe_tiles, row_count_ - row);
+
+            const f32 x = static_cast<f32>(region_.x_ + row * ae::raytracer::tile_size)
+                + 0.5f * static_cast<f32>(block_rows * ae::raytracer::tile_size);
+            const f32 y = static_cast<f32>(region_.y_ + col * ae::raytracer::tile_size)
+                + 0.5f * static_cast<f32>(block_cols * ae::raytracer::tile_size);
+
+            ae::ray_hit_info hit_info;
+            const u64 cost = rays_per_tile * (sphere.intersects(camera_ray(x, y), hit_info) ? 2 : 1);
+
+            for(u32 c = col; c < col + block_cols; c++) {
+                for(u32 r = row; r < row + block_rows; r++) {
+                    tile_estimates_[static_cast<size_t>(c) * row_count_ + r] = cost;
+                }
             }
         }
     }
 }
 
 bool software_raytracer::get_next_tile(tile_data &tile) {
+    AE_TRACE_SCOPE("get_next_tile");
     ae_scoped_lock lock{&next_tile_mutex};
 
-    if(current_col_ < col_count_) {
-        tile.row = current_row_;
-        tile.col = current_col_;
+    // Workers park here between passes until the next one begins or the render is finished
+    while(!finished_ && !issue_tile(tile)) {
+        if(drained_time_ == 0 && next_tile_ == tile_order_.size() && issued_tiles_ > 0) {
+            drained_time_ = ae::system_time_ns();
+        }
+
+        ae_cond_wait(&pass_ready_cv, &next_tile_mutex);
+    }
+
+    return !finished_;
+}
+
+bool software_raytracer::issue_tile(tile_data &tile) {
+    while(next_tile_ < tile_order_.size()) {
+        const u32 index = tile_order_[next_tile_++];
+        const u32 row = index % row_count_;
+        const u32 col = index / row_count_;
+
+        if(tile_needs_pass(row, col, current_pass_)) {
+            tile.row = (region_.x_ / ae::raytracer::tile_size) + row;
+            tile.col = (region_.y_ / ae::raytracer::tile_size) + col;
+            tile.pass = current_pass_;
+
+            issued_tiles_++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool software_raytracer::tile_needs_pass(u32 row, u32 col, u32 pass) const {
+    // Tiles are always accumulated as a whole, so the first pixel speaks for the entire tile.
+    // Only a resumed pass can find tiles that are already done. Coordinates are relative to the region.
+    const size_t index = static_cast<size_t>(col * ae::raytracer::tile_size) * region_.width_
+        + (row * ae::raytracer::tile_size);
 
-        current_row_++;
+    return sample_counts_[index] <= pass;
+}
+
+u32 software_raytracer::begin_pass(u32 pass) {
+    u32 pending_tiles = 0;
 
-        if(current_row_ == row_count_) {
-            current_row_ = 0;
-            current_col_++;
+    for(u32 col = 0; col < col_count_; col++) {
+        for(u32 row = 0; row < row_count_; row++) {
+            pending_tiles += tile_needs_pass(row, col, pass) ? 1 : 0;
         }
+    }
 
+    ae_scoped_lock lock{&next_tile_mutex};
+
+    if(cost_order_) {
+        // Ties stay in row by row order, which keeps neighboring tiles together
+        std::iota(tile_order_.begin(), tile_order_.end(), 0u);
+        std::stable_sort(tile_order_.begin(), tile_order_.end(), [this](u32 a, u32 b) {
+            return tile_estimates_[a] > tile_estimates_[b];
+        });
+    }
+
+    current_pass_ = pass;
+    next_tile_ = 0;
+    issued_tiles_ = 0;
+    drained_time_ = 0;
+
+    cond_broadcast(&pass_ready_cv);
+
+    return pending_tiles;
+}
+
+u32 software_raytracer::stop_issuing() {
+    ae_scoped_lock lock{&next_tile_mutex};
+
+    next_tile_ = static_cast<u32>(tile_order_.size());
+
+    return issued_tiles_;
+}
+
+void software_raytracer::accumulate_tile(const tile_data &tile) {
+    AE_TRACE_SCOPE("accumulate_tile");
+
+    // The next pass is ordered by what this one measured, tile times if they are taken at all
+    if(cost_order_) {
+        tile_estimates_[static_cast<size_t>(tile.col - region_.y_ / ae::raytracer::tile_size) * row_count_
+                        + (tile.row - region_.x_ / ae::raytracer::tile_size)] =
+            (tile.trace_ns > 0) ? tile.trace_ns : (tile.intersection_tests + tile.hits);
+    }
+
+    if(!tile_costs_.empty()) {
+        tile_cost &cost = tile_costs_[static_cast<size_t>(tile.col - region_.y_ / ae::raytracer::tile_size) * row_count_
+                                      + (tile.row - region_.x_ / ae::raytracer::tile_size)];
+
+        cost.trace_ns_ += tile.trace_ns;
+        cost.rays_ += ae::raytracer::tile_size * ae::raytracer::tile_size;
+        cost.intersection_tests_ += tile.intersection_tests;
+        cost.hits_ += tile.hits;
+    }
+
+    const u32 ystart = tile.col * ae::raytracer::tile_size;
+    const u32 yend = ystart + ae::raytracer::tile_size;
+
+    const u32 xstart = tile.row * ae::raytracer::tile_size;
+    const u32 xend = xstart + ae::raytracer::tile_size;
+
+    u32 tile_index = 0;
+
+    for(u32 y = ystart; y < yend; y++) {
+        for(u32 x = xstart; x < xend; x++) {
+            const size_t index = static_cast<size_t>(y - region_.y_) * region_.width_ + (x - region_.x_);
+            const ae::color &sample = tile.samples[tile_index++];
+
+            accumulation_[index] += ae::vec4f(sample.r_, sample.g_, sample.b_, sample.a_);
+            sample_counts_[index]++;
+
+            resolve_pixel(index);
+        }
+    }
+
+    ae::stats_first_pixel();
+}
+
+void ray_counters::add_tile(const tile_data &tile) {
+    // Every pixel of a tile gets one primary ray and one sample per pass
+    primary_rays_ += ae::raytracer::tile_size * ae::raytracer::tile_size;
+    samples_ += ae::raytracer::tile_size * ae::raytracer::tile_size;
+    intersection_tests_ += tile.intersection_tests;
+    hits_ += tile.hits;
+}
+
+void ray_counters::add(const ray_counters &other) {
+    primary_rays_ += other.primary_rays_;
+    intersection_tests_ += other.intersection_tests_;
+    hits_ += other.hits_;
+    samples_ += other.samples_;
+}
+
+void software_raytracer::resolve_pixel(size_t index) {
+    const ae::vec4f average = accumulation_[index] / static_cast<f32>(sample_counts_[index]);
+    framebuffer_[index] = ae::color(average.x_, average.y_, average.z_, average.w_).get_argb32();
+}
+
+bool software_raytracer::write_heatmap() const {
+    u64 max_trace_ns = 1;
+
+    for(const tile_cost &cost : tile_costs_) {
+        max_trace_ns = ae::max(max_trace_ns, cost.trace_ns_);
+    }
+
+    // Cheap tiles are blue, the most expensive one is red
+    std::vector<u32> pixels(static_cast<size_t>(region_.width_) * region_.height_);
+
+    for(u32 y = 0; y < region_.height_; y++) {
+        for(u32 x = 0; x < region_.width_; x++) {
+            const tile_cost &cost = tile_costs_[static_cast<size_t>(y / ae::raytracer::tile_size) * row_count_
+                                                + (x / ae::raytracer::tile_size)];
+            const f32 t = static_cast<f32>(cost.trace_ns_) / static_cast<f32>(max_trace_ns);
+
+            pixels[static_cast<size_t>(y) * region_.width_ + x] =
+                ae::color(ae::hsv{ .h_ = 240.0f * (1.0f - t), .s_ = 1.0f, .v_ = 1.0f, .a_ = 1.0f }).get_argb32();
+        }
+    }
+
+    if(!ae::output::write_snapshot(heatmap_path_, pixels.data(), snapshot_layout_)) {
+        return false;
+    }
+
+    // heatmap.tga -> heatmap.csv
+    const size_t separator = heatmap_path_.find_last_of("/\\");
+    size_t extension = heatmap_path_.rfind('.');
+
+    if(extension == std::string::npos || (separator != std::string::npos && extension < separator)) {
+        extension = heatmap_path_.size();
+    }
+
+    const std::string csv_path = heatmap_path_.substr(0, extension) + ".csv";
+    std::FILE *csv = std::fopen(csv_path.c_str(), "w");
+
+    if(!csv) {
+        return false;
+    }
+
+    // Tile coordinates and pixel positions are in the full frame
+    std::fprintf(csv, "tile_x,tile_y,x,y,trace_us,rays,intersection_tests,hits\n");
+
+    for(u32 col = 0; col < col_count_; col++) {
+        for(u32 row = 0; row < row_count_; row++) {
+            const tile_cost &cost = tile_costs_[static_cast<size_t>(col) * row_count_ + row];
+            const u32 x = region_.x_ + row * ae::raytracer::tile_size;
+            const u32 y = region_.y_ + col * ae::raytracer::tile_size;
+
+            std::fprintf(csv,
+                         "%u,%u,%u,%u,%.3f,%llu,%llu,%llu\n",
+                         x / ae::raytracer::tile_size,
+                         y / ae::raytracer::tile_size,
+                         x,
+                         y,
+                         static_cast<f64>(cost.trace_ns_) / 1000.0,
+                         static_cast<unsigned long long>(cost.rays_),
+                         static_cast<unsigned long long>(cost.intersection_tests_),
+                         static_cast<unsigned long long>(cost.hits_));
+        }
+    }
+
+    return std::fclose(csv) == 0;
+}
+
+bool software_raytracer::should_stop(u32 completed_passes, u64 elapsed_ns, u64 last_pass_ns) const {
+    if(target_spp_ > 0 && completed_passes >= target_spp_) {
         return true;
     }
 
-    finished_ = true;
-    return false;
+    // Stop once another pass would likely overrun the budget rather than after it already has
+    return time_budget_ns_ > 0 && (elapsed_ns + last_pass_ns) > time_budget_ns_;
 }
 
 template<typename TType>
@@ -265,10 +751,13 @@ TType software_raytracer::thread_func(void *data) {
     software_raytracer *rt = static_cast<software_raytracer *>(data);
 
     tile_data tile;
+    ray_counters &counters = rt->thread_counters_[rt->next_thread_counters_.fetch_add(1)];
 
     while(rt->get_next_tile(tile)) {
         rt->trace_tile(tile);
+        counters.add_tile(tile);
 
+        AE_TRACE_SCOPE("push tile");
         ae_scoped_lock lock{&queue_mutex};
         rt->tile_queue_.push(tile);
         cond_signal(&queue_ready_cv);
@@ -282,7 +771,9 @@ TType software_raytracer::thread_func(void *data) {
 #ifdef AE_PLATFORM_WIN32
 void ae_cond_wait(ae_condition_variable *cv, ae_mutex *mutex) { SleepConditionVariableCS(cv, mutex, INFINITE); }
 void cond_signal(ae_condition_variable *cv) { WakeConditionVariable(cv); }
+void cond_broadcast(ae_condition_variable *cv) { WakeAllConditionVariable(cv); }
 #elif defined(AE_PLATFORM_LINUX)
 void ae_cond_wait(ae_condition_variable *cv, ae_mutex *mutex) { pthread_cond_wait(cv, mutex); }
 void cond_signal(ae_condition_variable *cv) { pthread_cond_signal(cv); }
+void cond_broadcast(ae_condition_variable *cv) { pthread_cond_broadcast(cv); }
 #endif
@@ -1,9 +1,20 @@
 #pragma once
 
+#include "checkpoint.h"
+#include "color.h"
+#include "memory.h"
+#include "output.h"
+#include "ray.h"
 #include "raytracer.h"
 #include "vec.h"
 
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <queue>
+#include <span>
+#include <string>
+#include <vector>
 
 namespace ae {
     class sphere;
@@ -11,35 +22,121 @@ namespace ae {
     struct tile_data {
         u32 row;
         u32 col;
-        u32 pixels[ae::raytracer::tile_size * ae::raytracer::tile_size];
+        u32 pass;
+
+        // Filled in by the thread that traced the tile, trace_ns only if costs are recorded
+        u64 trace_ns;
+        u32 intersection_tests;
+        u32 hits;
+
+        ae::color samples[ae::raytracer::tile_size * ae::raytracer::tile_size];
+    };
+
+    // One per tracing thread, each on its own cache line so counting never makes threads share a line
+    struct alignas(64) ray_counters {
+        u64 primary_rays_ = 0;
+        u64 intersection_tests_ = 0;
+        u64 hits_ = 0;
+        u64 samples_ = 0;
+
+        void add_tile(const tile_data &tile);
+        void add(const ray_counters &other);
+    };
+
+    static_assert(sizeof(ray_counters) == 64);
+
+    // Totals of one tile over all passes
+    struct tile_cost {
+        u64 trace_ns_ = 0;
+        u64 rays_ = 0;
+        u64 intersection_tests_ = 0;
+        u64 hits_ = 0;
     };
 
     class software_raytracer final : public raytracer {
     public:
         software_raytracer(u32 *buffer);
 
+        // Renders only the given part of the frame, buffer holds just that region
+        software_raytracer(u32 *buffer, const ae::raytracer::region &region);
+
         bool setup() override;
-        void trace() override;
+        bool trace() override;
+
+        // Threads tracing tiles. With more than one the calling thread only collects them. 0 uses one per
+        // logical processor, the calling thread collecting on the last one.
+        void set_thread_count(u32 count) { requested_threads_ = count; }
+
+        // Row by row over the tiles of the region, only filled in with --heatmap
+        std::span<const tile_cost> tile_costs() const { return tile_costs_; }
+
+        // Summed over all threads at the end of trace(), which also records them into the stats
+        const ray_counters & counters() const { return counters_; }
 
     private:
+        ae::ray camera_ray(f32 x, f32 y) const;
         void trace_tile(tile_data &tile);
+        void estimate_tile_costs();
         bool get_next_tile(tile_data &tile);
+        bool issue_tile(tile_data &tile);
+        bool tile_needs_pass(u32 row, u32 col, u32 pass) const;
+        u32 begin_pass(u32 pass);
+        u32 stop_issuing();
+        void accumulate_tile(const tile_data &tile);
+        void resolve_pixel(size_t index);
+        bool should_stop(u32 completed_passes, u64 elapsed_ns, u64 last_pass_ns) const;
+
+        // False-color image of the tile times over the region, plus the whole grid as CSV next to it
+        bool write_heatmap() const;
 
         template<typename TType>
         static TType thread_func(void *data);
 
-        std::queue<tile_data> tile_queue_;
+        std::queue<tile_data, std::deque<tile_data, ae::tracked_allocator<tile_data, ae::memory_category::tiles>>> tile_queue_;
+
+        // Running per-pixel sums and sample counts, resolved into the framebuffer as tiles arrive.
+        // They point either into the storage vectors or into the checkpoint's buffers.
+        ae::vec4f *accumulation_ = nullptr;
+        u32 *sample_counts_ = nullptr;
+        ae::tracked_vector<ae::vec4f, ae::memory_category::framebuffer> accumulation_storage_;
+        ae::tracked_vector<u32, ae::memory_category::framebuffer> sample_count_storage_;
+        std::unique_ptr<ae::checkpoint> checkpoint_;
+        ae::tracked_vector<tile_cost, ae::memory_category::tiles> tile_costs_;
+
+        // Indices into the row by row tile grid of the region in the order a pass hands them out. With cost
+        // ordering the most expensive tiles go first, so cheap ones fill the gaps at the end of the pass.
+        ae::tracked_vector<u32, ae::memory_category::tiles> tile_order_;
+        ae::tracked_vector<u64, ae::memory_category::tiles> tile_estimates_; // From the pre-pass or the last pass
+        u64 drained_time_ = 0; // When the first thread ran out of tiles in the current pass
+        std::vector<ray_counters> thread_counters_; // The calling thread's first, then the workers'
+        std::atomic<u32> next_thread_counters_ = 0;
+        ray_counters counters_;
+
+        ae::output::image_layout snapshot_layout_;
+        std::string snapshot_path_;
+        std::string heatmap_path_;
+        u64 time_budget_ns_ = 0;
+        u64 snapshot_interval_ns_ = 0;
+        u64 checkpoint_interval_ns_ = 0;
 
         ae::vec4f viewport_size_;
         ae::vec4f pixel_size_;
 
+        ae::raytracer::region region_;
+
         u32 width_ = 0;
         u32 height_ = 0;
-        u32 row_count_ = 0;
+        u32 row_count_ = 0; // Tiles in the region, not in the whole frame
         u32 col_count_ = 0;
-        u32 current_row_ = 0;
-        u32 current_col_ = 0;
+        u32 next_tile_ = 0; // Position in tile_order_
+        u32 current_pass_ = 0;
+        u32 issued_tiles_ = 0; // Handed out during the current pass
+        u32 first_pass_ = 0;
+        u32 target_spp_ = 1; // 0 means no limit
+        u32 seed_ = 0;
+        u32 requested_threads_ = 0;
 
         bool finished_ : 1 = false;
+        bool cost_order_ : 1 = true;
     };
 }
@@ -0,0 +1,190 @@
+#include "stats.h"
+
+#include "commands.h"
+#include "system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+    struct stats_entry {
+        std::string section_;
+        std::string name_;
+        std::string unit_;
+        u64 count_ = 0;
+        f64 total_ = 0.0;
+        f64 min_ = 0.0;
+        f64 max_ = 0.0;
+    };
+
+    std::mutex stats_mutex;
+    std::vector<stats_entry> stats_entries;
+    std::atomic<bool> stats_first_pixel_recorded = false;
+
+    // Sections in the order they were first recorded, each followed by its entries
+    std::vector<std::vector<const stats_entry *>> group_by_section() {
+        std::vector<std::vector<const stats_entry *>> sections;
+
+        for(const stats_entry &entry : stats_entries) {
+            auto section = std::find_if(sections.begin(), sections.end(), [&entry](const auto &group) {
+                return group.front()->section_ == entry.section_;
+            });
+
+            if(section == sections.end()) {
+                sections.push_back({ &entry });
+            } else {
+                section->push_back(&entry);
+            }
+        }
+
+        return sections;
+    }
+
+    void write_json_string(std::FILE *file, std::string_view str) {
+        std::fputc('"', file);
+
+        for(const char c : str) {
+            if(c == '"' || c == '\\') {
+                std::fputc('\\', file);
+            }
+
+            std::fputc(c, file);
+        }
+
+        std::fputc('"', file);
+    }
+}
+
+namespace ae {
+
+void stats_record(std::string_view section, std::string_view name, f64 value, std::string_view unit) {
+    std::lock_guard lock(stats_mutex);
+
+    auto entry = std::find_if(stats_entries.begin(), stats_entries.end(), [section, name](const stats_entry &e) {
+        return e.section_ == section && e.name_ == name;
+    });
+
+    if(entry == stats_entries.end()) {
+        stats_entries.push_back({
+            .section_ = std::string(section),
+            .name_ = std::string(name),
+            .unit_ = std::string(unit),
+            .count_ = 1,
+            .total_ = value,
+            .min_ = value,
+            .max_ = value
+        });
+
+        return;
+    }
+
+    entry->count_++;
+    entry->total_ += value;
+    entry->min_ = std::min(entry->min_, value);
+    entry->max_ = std::max(entry->max_, value);
+}
+
+bool stats_write_text(std::FILE *file) {
+    std::lock_guard lock(stats_mutex);
+
+    for(const std::vector<const stats_entry *> &section : group_by_section()) {
+        std::fprintf(file, "%s\n", section.front()->section_.c_str());
+
+        for(const stats_entry *entry : section) {
+            if(entry->count_ == 1) {
+                std::fprintf(file, "  %-24s %12.3f %s\n", entry->name_.c_str(), entry->total_, entry->unit_.c_str());
+            } else {
+                std::fprintf(file,
+                             "  %-24s %12.3f %s mean, %.3f min, %.3f max, %.3f total over %llu\n",
+                             entry->name_.c_str(),
+                             entry->total_ / static_cast<f64>(entry->count_),
+                             entry->unit_.c_str(),
+                             entry->min_,
+                             entry->max_,
+                             entry->total_,
+                             static_cast<unsigned long long>(entry->count_));
+            }
+        }
+    }
+
+    return std::ferror(file) == 0;
+}
+
+bool stats_write_json(std::FILE *file) {
+    std::lock_guard lock(stats_mutex);
+
+    const std::vector<std::vector<const stats_entry *>> sections = group_by_section();
+
+    std::fputs("{\n", file);
+
+    for(size_t i = 0; i < sections.size(); i++) {
+        std::fputs("  ", file);
+        write_json_string(file, sections[i].front()->section_);
+        std::fputs(": {\n", file);
+
+        for(size_t j = 0; j < sections[i].size(); j++) {
+            const stats_entry *entry = sections[i][j];
+
+            std::fputs("    ", file);
+            write_json_string(file, entry->name_);
+            std::fputs(": { \"unit\": ", file);
+            write_json_string(file, entry->unit_);
+            std::fprintf(file,
+                         ", \"count\": %llu, \"total\": %.6f, \"mean\": %.6f, \"min\": %.6f, \"max\": %.6f }%s\n",
+                         static_cast<unsigned long long>(entry->count_),
+                         entry->total_,
+                         entry->total_ / static_cast<f64>(entry->count_),
+                         entry->min_,
+                         entry->max_,
+                         (j + 1 < sections[i].size()) ? "," : "");
+        }
+
+        std::fprintf(file, "  }%s\n", (i + 1 < sections.size()) ? "," : "");
+    }
+
+    std::fputs("}\n", file);
+
+    return std::ferror(file) == 0;
+}
+
+bool stats_report() {
+    const ae::command_handler &commands = ae::command_handler::get();
+    bool success = true;
+
+    if(std::get<bool>(commands.value("stats"_hash))) {
+        success = stats_write_text(stdout) && success;
+    }
+
+    if(const ae::command_handler::variant path = commands.value("stats-json"_hash);
+       std::holds_alternative<std::string>(path)) {
+
+        std::FILE *file = std::fopen(std::get<std::string>(path).c_str(), "w");
+
+        if(!file) {
+            return false;
+        }
+
+        success = stats_write_json(file) && success;
+        success = (std::fclose(file) == 0) && success;
+    }
+
+    return success;
+}
+
+f64 stats_elapsed_ms(u64 start_ns) {
+    return static_cast<f64>(ae::system_time_ns() - start_ns) / 1000000.0;
+}
+
+void stats_first_pixel() {
+    // Called for every finished tile, so the common case must not take the lock
+    if(stats_first_pixel_recorded.load(std::memory_order_relaxed) || stats_first_pixel_recorded.exchange(true)) {
+        return;
+    }
+
+    ae::stats_record("startup", "time_to_first_pixel", ae::stats_elapsed_ms(ae::system_start_time_ns()));
+}
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdio>
+#include <string_view>
+
+namespace ae {
+    // Measurements gathered over a run, grouped by section and reported at exit with --stats (text on stdout)
+    // and --stats-json <file>. Recording a name again adds another sample to it, the report shows the
+    // sample count, total, mean, min and max. Safe to call from any thread.
+    void stats_record(std::string_view section, std::string_view name, f64 value, std::string_view unit = "ms");
+
+    bool stats_write_text(std::FILE *file);
+    bool stats_write_json(std::FILE *file);
+
+    // Writes whichever reports were requested on the command line
+    bool stats_report();
+
+    // Milliseconds since start_ns, a system_time_ns() value
+    f64 stats_elapsed_ms(u64 start_ns);
+
+    // Records the time from system_init() to the first finished pixels of the run, later calls are ignored
+    void stats_first_pixel();
+}
@@ -2,11 +2,17 @@
 
 #ifdef AE_PLATFORM_WIN32
 #include "common_win32.h"
+#include <psapi.h>
 #elif defined(AE_PLATFORM_LINUX)
 #include "common_linux.h"
+#include <sys/resource.h>
 #endif
 
 #include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
 
 #define X(item) bool item : 1;
 static struct {
@@ -14,6 +20,9 @@ static struct {
 } system_supported_feature_bits;
 #undef X
 
+static volatile std::sig_atomic_t system_termination_flag = 0;
+static u64 system_start_ns = 0;
+
 namespace ae {
 
 void system_init() {
@@ -23,6 +32,8 @@ void system_init() {
         return;
     }
 
+    system_start_ns = system_time_ns();
+
     const int leaf = 1;
     int cpu_info[4];
 
@@ -59,4 +70,131 @@ bool system_has_feature(cpu_feature feature) {
     return false;
 }
 
+u64 system_start_time_ns() {
+    return system_start_ns;
+}
+
+u64 system_time_ns() {
+#ifdef AE_PLATFORM_WIN32
+    static LARGE_INTEGER frequency = {};
+
+    if(frequency.QuadPart == 0) [[unlikely]] {
+        QueryPerformanceFrequency(&frequency);
+    }
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    const u64 ticks = static_cast<u64>(counter.QuadPart);
+    const u64 freq = static_cast<u64>(frequency.QuadPart);
+
+    return (ticks / freq) * 1000000000ull + ((ticks % freq) * 1000000000ull) / freq;
+#elif defined(AE_PLATFORM_LINUX)
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return static_cast<u64>(ts.tv_sec) * 1000000000ull + static_cast<u64>(ts.tv_nsec);
+#endif
+}
+
+u32 system_cpu_count() {
+#ifdef AE_PLATFORM_WIN32
+    SYSTEM_INFO sysinfo;
+    GetSystemInfo(&sysinfo);
+
+    return (sysinfo.dwNumberOfProcessors > 0) ? static_cast<u32>(sysinfo.dwNumberOfProcessors) : 1;
+#elif defined(AE_PLATFORM_LINUX)
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (count > 0) ? static_cast<u32>(count) : 1;
+#endif
+}
+
+u64 system_peak_rss_bytes() {
+#ifdef AE_PLATFORM_WIN32
+    PROCESS_MEMORY_COUNTERS counters = {};
+
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))
+        ? static_cast<u64>(counters.PeakWorkingSetSize)
+        : 0;
+#elif defined(AE_PLATFORM_LINUX)
+    rusage usage = {};
+
+    // ru_maxrss is in kilobytes on Linux
+    return (getrusage(RUSAGE_SELF, &usage) == 0) ? static_cast<u64>(usage.ru_maxrss) * 1024 : 0;
+#endif
+}
+
+void system_catch_termination() {
+#ifdef AE_PLATFORM_WIN32
+    SetConsoleCtrlHandler([](DWORD type) -> BOOL {
+        switch(type) {
+            case CTRL_C_EVENT:
+            case CTRL_BREAK_EVENT:
+            case CTRL_CLOSE_EVENT:
+            case CTRL_SHUTDOWN_EVENT:
+                system_termination_flag = 1;
+                return TRUE;
+            default:
+                return FALSE;
+        }
+    }, TRUE);
+#elif defined(AE_PLATFORM_LINUX)
+    struct sigaction action = {};
+    action.sa_handler = [](int) { system_termination_flag = 1; };
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+#endif
+}
+
+bool system_termination_requested() {
+    return system_termination_flag != 0;
+}
+
+std::string system_cache_directory() {
+#ifdef AE_PLATFORM_WIN32
+    const char *base = std::getenv("LOCALAPPDATA");
+
+    if(!base || *base == '\0') {
+        return {};
+    }
+
+    std::string path = std::string(base) + "\\raytracer";
+
+    if(!CreateDirectoryA(path.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        return {};
+    }
+#elif defined(AE_PLATFORM_LINUX)
+    std::string path;
+
+    if(const char *xdg_cache = std::getenv("XDG_CACHE_HOME"); xdg_cache && *xdg_cache != '\0') {
+        path = xdg_cache;
+    } else if(const char *home = std::getenv("HOME"); home && *home != '\0') {
+        path = std::string(home) + "/.cache";
+    } else {
+        return {};
+    }
+
+    // The base directory might not exist yet on a fresh account
+    mkdir(path.c_str(), 0700);
+    path += "/raytracer";
+
+    if(mkdir(path.c_str(), 0700) != 0 && errno != EEXIST) {
+        return {};
+    }
+#endif
+
+    return path;
+}
+
+bool system_replace_file(const char *source, const char *destination) {
+#ifdef AE_PLATFORM_WIN32
+    return MoveFileExA(source, destination, MOVEFILE_REPLACE_EXISTING) != 0;
+#elif defined(AE_PLATFORM_LINUX)
+    return std::rename(source, destination) == 0;
+#endif
+}
+
 }
@@ -2,6 +2,8 @@
 
 #include "common.h"
 
+#include <string>
+
 #define CPU_FEATURE_LIST \
     X(sse2) \
     X(rdrand)
@@ -15,4 +17,28 @@ namespace ae {
 
     void system_init();
     bool system_has_feature(cpu_feature feature);
+
+    // Monotonic clock, only meaningful for measuring intervals
+    u64 system_time_ns();
+
+    // system_time_ns() when system_init() ran, the reference point for startup measurements
+    u64 system_start_time_ns();
+
+    // Logical processors available to the process, at least 1
+    u32 system_cpu_count();
+
+    // Most physical memory the process has used at once so far, 0 if unknown
+    u64 system_peak_rss_bytes();
+
+    // Turns termination requests (SIGTERM/SIGINT, console close/break events on Windows) into a flag
+    // that long renders poll, so they can persist their state before exiting
+    void system_catch_termination();
+    bool system_termination_requested();
+
+    // Per-user directory for data that can be rebuilt at any time, like pipeline caches. It gets created
+    // on the first call, an empty string means there is no usable cache directory.
+    std::string system_cache_directory();
+
+    // Moves source over destination, replacing it atomically if it exists
+    bool system_replace_file(const char *source, const char *destination);
 }
@@ -0,0 +1,131 @@
+#include "tiled_output.h"
+
+#include "aemath.h"
+#include "rle.h"
+
+#include <cstring>
+#include <string>
+
+namespace ae {
+
+tiled_output::tiled_output(std::string_view file_name, const ae::output::image_layout &layout)
+    : layout_(layout) {
+    if(layout_.width_ == 0 || layout_.height_ == 0) {
+        return;
+    }
+
+    blocks_x_ = (layout_.width_ + block_size - 1) / block_size;
+    blocks_y_ = (layout_.height_ + block_size - 1) / block_size;
+
+    const std::string path(file_name);
+    file_ = std::fopen(path.c_str(), "wb");
+
+    if(!file_) {
+        return;
+    }
+
+    const file_header header = {
+        .magic_ = magic,
+        .version_ = version,
+        .block_size_ = block_size,
+        .width_ = layout_.width_,
+        .height_ = layout_.height_,
+        .x_ = layout_.x_,
+        .y_ = layout_.y_,
+        .frame_width_ = layout_.frame_width_,
+        .frame_height_ = layout_.frame_height_
+    };
+
+    block_offsets_.reserve(static_cast<size_t>(blocks_x_) * blocks_y_ + 1);
+    block_pixels_.resize(block_size * block_size);
+
+    if(!write_bytes(&header, sizeof(header))) {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+tiled_output::~tiled_output() {
+    if(file_) {
+        std::fclose(file_);
+    }
+}
+
+bool tiled_output::write(const u32 *pixels, u32 x, u32 y, u32 width, u32 height) {
+    const u32 block_count = blocks_x_ * blocks_y_;
+
+    if(!file_ || next_block_ >= block_count) {
+        return false;
+    }
+
+    const u32 block_x = (next_block_ % blocks_x_) * block_size;
+    const u32 block_y = (next_block_ / blocks_x_) * block_size;
+
+    const bool valid = x == block_x
+        && y == block_y
+        && width > 0
+        && (x + width) <= layout_.width_
+        && ((width % block_size) == 0 || (x + width) == layout_.width_)
+        && height == ae::min(block_size, layout_.height_ - y);
+
+    if(!valid) {
+        return false;
+    }
+
+    for(u32 chunk_x = 0; chunk_x < width; chunk_x += block_size) {
+        const u32 block_width = ae::min(block_size, width - chunk_x);
+        const size_t block_pixel_count = static_cast<size_t>(block_width) * height;
+
+        for(u32 row = 0; row < height; row++) {
+            std::memcpy(block_pixels_.data() + static_cast<size_t>(row) * block_width,
+                        pixels + static_cast<size_t>(row) * width + chunk_x,
+                        block_width * sizeof(u32));
+        }
+
+        encoded_.clear();
+        ae::rle_encode(std::span(block_pixels_.data(), block_pixel_count), encoded_);
+
+        block_offsets_.push_back(file_offset_);
+
+        if(!write_bytes(encoded_.data(), encoded_.size())) {
+            return false;
+        }
+
+        next_block_++;
+    }
+
+    return true;
+}
+
+bool tiled_output::finish() {
+    if(!file_ || next_block_ != blocks_x_ * blocks_y_) {
+        return false;
+    }
+
+    block_offsets_.push_back(file_offset_);
+
+    const file_footer footer = {
+        .table_offset_ = file_offset_,
+        .block_count_ = next_block_,
+        .magic_ = magic
+    };
+
+    const bool written = write_bytes(block_offsets_.data(), block_offsets_.size() * sizeof(u64))
+        && write_bytes(&footer, sizeof(footer));
+    const bool success = (std::fclose(file_) == 0) && written;
+
+    file_ = nullptr;
+
+    return success;
+}
+
+bool tiled_output::write_bytes(const void *data, size_t size) {
+    if(size > 0 && std::fwrite(data, 1, size, file_) != size) {
+        return false;
+    }
+
+    file_offset_ += size;
+    return true;
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "common.h"
+#include "output.h"
+
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+namespace ae {
+    // Container for images that TGA can't describe or that don't fit in memory. The image is cut into
+    // block_size x block_size blocks (smaller along the right and bottom edges), each run-length encoded
+    // on its own and appended in row-major order as soon as its pixels are available.
+    //
+    // File layout: file_header, the encoded blocks, a block table of u64 file offsets (one per block
+    // plus the end of the last block), file_footer. Everything is written sequentially.
+    class tiled_output {
+    public:
+        static constexpr u32 block_size = 64;
+
+        tiled_output(std::string_view file_name, const ae::output::image_layout &layout);
+        ~tiled_output();
+
+        tiled_output(const tiled_output &) = delete;
+        tiled_output & operator=(const tiled_output &) = delete;
+
+        bool is_valid() const { return file_ != nullptr; }
+
+        // Appends a chunk of width x height pixels at (x, y), relative to the image. Chunks have to arrive in
+        // block order: a chunk starts at the next unwritten block, spans whole blocks and stays inside one band
+        // of block rows.
+        bool write(const u32 *pixels, u32 x, u32 y, u32 width, u32 height);
+
+        // Writes the block table once every block has been written
+        bool finish();
+
+    private:
+        struct file_header {
+            u32 magic_ = 0;
+            u32 version_ = 0;
+            u32 block_size_ = 0;
+            u32 width_ = 0;
+            u32 height_ = 0;
+            u32 x_ = 0;
+            u32 y_ = 0;
+            u32 frame_width_ = 0;
+            u32 frame_height_ = 0;
+        };
+
+        struct file_footer {
+            u64 table_offset_ = 0;
+            u32 block_count_ = 0;
+            u32 magic_ = 0;
+        };
+
+        static constexpr u32 magic = 0x49544541; // "AETI"
+        static constexpr u32 version = 1;
+
+        bool write_bytes(const void *data, size_t size);
+
+        ae::output::image_layout layout_;
+        std::vector<u64> block_offsets_;
+        std::vector<u32> block_pixels_;
+        std::vector<u8> encoded_;
+        std::FILE *file_ = nullptr;
+        u64 file_offset_ = 0;
+        u32 blocks_x_ = 0;
+        u32 blocks_y_ = 0;
+        u32 next_block_ = 0;
+    };
+}
@@ -0,0 +1,150 @@
+#include "trace.h"
+
+#ifdef AE_TRACE
+
+#include "commands.h"
+#include "system.h"
+
+#ifdef AE_PLATFORM_WIN32
+#include "common_win32.h"
+#include <intrin.h>
+#elif defined(AE_PLATFORM_LINUX)
+#include "common_linux.h"
+#include <x86intrin.h>
+#endif
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+    constexpr u32 ring_capacity = 1 << 16; // Events per thread
+
+    struct trace_event {
+        const char *name_;
+        u64 begin_;
+        u64 end_;
+    };
+
+    struct trace_ring {
+        std::vector<trace_event> events_ = std::vector<trace_event>(ring_capacity);
+        u64 recorded_ = 0; // Also counts the overwritten events
+        u32 thread_index_ = 0;
+        bool in_use_ = false;
+    };
+
+    // Rings outlive their threads, workers are gone by the time the trace gets written. There are only ever
+    // as many as threads recorded at once, a new thread continues the ring of one that exited.
+    std::mutex trace_rings_mutex;
+    std::vector<std::unique_ptr<trace_ring>> trace_rings;
+
+    // TSC ticks get converted with the rate observed between startup and the dump
+    const u64 trace_start_tsc = __rdtsc();
+    const u64 trace_start_ns = ae::system_time_ns();
+
+    // Hands the ring back when its thread exits
+    struct ring_owner {
+        trace_ring *ring_ = nullptr;
+
+        ~ring_owner() {
+            if(ring_) {
+                std::lock_guard lock(trace_rings_mutex);
+                ring_->in_use_ = false;
+            }
+        }
+    };
+
+    trace_ring & thread_ring() {
+        thread_local ring_owner owner;
+
+        if(!owner.ring_) [[unlikely]] {
+            std::lock_guard lock(trace_rings_mutex);
+
+            for(const std::unique_ptr<trace_ring> &ring : trace_rings) {
+                if(!ring->in_use_) {
+                    owner.ring_ = ring.get();
+                    break;
+                }
+            }
+
+            if(!owner.ring_) {
+                trace_rings.push_back(std::make_unique<trace_ring>());
+                owner.ring_ = trace_rings.back().get();
+                owner.ring_->thread_index_ = static_cast<u32>(trace_rings.size());
+            }
+
+            owner.ring_->in_use_ = true;
+        }
+
+        return *owner.ring_;
+    }
+}
+
+namespace ae {
+
+u64 trace_timestamp() {
+    return __rdtsc();
+}
+
+void trace_record(const char *name, u64 begin, u64 end) {
+    trace_ring &ring = thread_ring();
+
+    ring.events_[ring.recorded_ % ring_capacity] = { .name_ = name, .begin_ = begin, .end_ = end };
+    ring.recorded_++;
+}
+
+bool trace_write() {
+    const ae::command_handler::variant path = ae::command_handler::get().value("trace"_hash);
+    const std::string file_name = std::holds_alternative<std::string>(path) ? std::get<std::string>(path) : "trace.json";
+
+    std::lock_guard lock(trace_rings_mutex);
+
+    const u64 elapsed_ns = ae::system_time_ns() - trace_start_ns;
+    const u64 elapsed_tsc = __rdtsc() - trace_start_tsc;
+    const f64 us_per_tick = (elapsed_tsc > 0) ? (static_cast<f64>(elapsed_ns) / 1000.0) / static_cast<f64>(elapsed_tsc) : 0.0;
+
+    std::FILE *file = std::fopen(file_name.c_str(), "w");
+
+    if(!file) {
+        return false;
+    }
+
+    std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    bool first = true;
+
+    for(const std::unique_ptr<trace_ring> &ring : trace_rings) {
+        std::fprintf(file,
+                     "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                     first ? "" : ",\n",
+                     ring->thread_index_,
+                     ring->thread_index_);
+        first = false;
+
+        const u64 count = (ring->recorded_ < ring_capacity) ? ring->recorded_ : ring_capacity;
+
+        for(u64 i = ring->recorded_ - count; i < ring->recorded_; i++) {
+            const trace_event &event = ring->events_[i % ring_capacity];
+
+            const u64 begin = (event.begin_ > trace_start_tsc) ? (event.begin_ - trace_start_tsc) : 0;
+            const u64 duration = (event.end_ > event.begin_) ? (event.end_ - event.begin_) : 0;
+
+            std::fprintf(file,
+                         ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                         event.name_,
+                         ring->thread_index_,
+                         static_cast<f64>(begin) * us_per_tick,
+                         static_cast<f64>(duration) * us_per_tick);
+        }
+    }
+
+    std::fprintf(file, "\n]}\n");
+
+    return std::fclose(file) == 0;
+}
+
+}
+
+#endif // AE_TRACE
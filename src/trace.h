@@ -0,0 +1,50 @@
+#pragma once
+
+#include "common.h"
+
+// Timeline of the render pipeline in the Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+// Only compiled in with AE_TRACE (build.sh/build.bat --trace), otherwise the macros expand to nothing.
+// Every thread records completed scopes into its own ring buffer, so recording never takes a lock and
+// only the most recent events of a thread survive if it records more than fit. Threads that exit hand their
+// ring to the next thread that starts, so their events share a timeline row.
+
+#ifdef AE_TRACE
+
+namespace ae {
+    u64 trace_timestamp();
+
+    // name has to outlive the trace, string literals are
+    void trace_record(const char *name, u64 begin, u64 end);
+
+    // Writes the events of all threads to --trace, trace.json by default
+    bool trace_write();
+
+    class trace_scope {
+    public:
+        trace_scope(const char *name)
+            : name_(name)
+            , begin_(trace_timestamp()) {}
+
+        ~trace_scope() { trace_record(name_, begin_, trace_timestamp()); }
+
+        trace_scope(const trace_scope &) = delete;
+        trace_scope & operator=(const trace_scope &) = delete;
+
+    private:
+        const char *name_;
+        u64 begin_;
+    };
+}
+
+#define AE_TRACE_CONCAT_INNER(a, b) a##b
+#define AE_TRACE_CONCAT(a, b) AE_TRACE_CONCAT_INNER(a, b)
+
+#define AE_TRACE_SCOPE(name) ae::trace_scope AE_TRACE_CONCAT(ae_trace_scope_, __LINE__)(name)
+#define AE_TRACE_WRITE() ae::trace_write()
+
+#else
+
+#define AE_TRACE_SCOPE(name)
+#define AE_TRACE_WRITE() true
+
+#endif // AE_TRACE
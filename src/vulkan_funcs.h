@@ -12,8 +12,10 @@
     X(vkGetDeviceProcAddr) \
     X(vkDestroyInstance) \
     X(vkEnumeratePhysicalDevices) \
+    X(vkGetPhysicalDeviceProperties) \
     X(vkGetPhysicalDeviceQueueFamilyProperties) \
     X(vkGetPhysicalDeviceMemoryProperties) \
+    X(vkEnumerateDeviceExtensionProperties) \
     X(vkCreateDevice)
 
 #define AE_VULKAN_DEVICE_FUNCS \
@@ -28,6 +30,9 @@
     X(vkDestroyDescriptorPool) \
     X(vkCreatePipelineLayout) \
     X(vkDestroyPipelineLayout) \
+    X(vkCreatePipelineCache) \
+    X(vkDestroyPipelineCache) \
+    X(vkGetPipelineCacheData) \
     X(vkCreateComputePipelines) \
     X(vkDestroyPipeline) \
     X(vkCreateCommandPool) \
@@ -41,29 +46,51 @@
     X(vkCmdPushConstants) \
     X(vkCmdBindDescriptorSets) \
     X(vkCmdDispatch) \
+    X(vkCmdCopyImageToBuffer) \
+    X(vkCmdCopyBuffer) \
+    X(vkCmdResetQueryPool) \
+    X(vkCmdWriteTimestamp) \
+    X(vkCreateQueryPool) \
+    X(vkDestroyQueryPool) \
+    X(vkGetQueryPoolResults) \
     X(vkCreateFence) \
     X(vkDestroyFence) \
+    X(vkResetFences) \
     X(vkQueueSubmit) \
     X(vkQueueWaitIdle) \
     X(vkWaitForFences) \
     X(vkMapMemory) \
     X(vkUnmapMemory) \
+    X(vkInvalidateMappedMemoryRanges) \
     X(vkCreateImage) \
     X(vkDestroyImage) \
     X(vkCreateImageView) \
     X(vkDestroyImageView) \
+    X(vkCreateBuffer) \
+    X(vkDestroyBuffer) \
     X(vkGetImageMemoryRequirements) \
     X(vkAllocateMemory) \
     X(vkFreeMemory) \
     X(vkBindImageMemory) \
+    X(vkGetBufferMemoryRequirements) \
+    X(vkBindBufferMemory) \
     X(vkAllocateDescriptorSets) \
     X(vkFreeDescriptorSets) \
     X(vkUpdateDescriptorSets)
 
+// Loaded when available, these stay null otherwise
+#define AE_VULKAN_OPTIONAL_INSTANCE_FUNCS \
+    X(vkGetPhysicalDeviceProperties2)
+
+#define AE_VULKAN_OPTIONAL_DEVICE_FUNCS \
+    X(vkGetMemoryHostPointerPropertiesEXT)
+
 inline PFN_vkGetInstanceProcAddr vkGetInstanceProcAddr;
 
 #define X(item) inline PFN_##item item;
 AE_VULKAN_GLOBAL_FUNCS
 AE_VULKAN_INSTANCE_FUNCS
 AE_VULKAN_DEVICE_FUNCS
+AE_VULKAN_OPTIONAL_INSTANCE_FUNCS
+AE_VULKAN_OPTIONAL_DEVICE_FUNCS
 #undef X
@@ -6,13 +6,33 @@
 #include "common_linux.h"
 #endif
 
+#include "aemath.h"
+#include "commands.h"
+#include "memory.h"
+#include "scene.h"
+#include "stats.h"
+#include "system.h"
+#include "trace.h"
 #include "vec.h"
 #include "vulkan_funcs.h"
 
+// Generated from compute.hlsl by the build scripts. Without it the compute backend is unavailable,
+// loading SPIR-V from elsewhere risks running a shader built against an older interface.
+#if __has_include("compute_spirv.h")
+#include "compute_spirv.h"
+#define AE_EMBEDDED_SPIRV 1
+#endif
+
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstring>
+#include <cstddef>
 #include <initializer_list>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <vulkan/vulkan.h>
@@ -20,11 +40,226 @@
 struct push_constants {
     ae::color bg0;
     ae::color bg1;
-    ae::vec4f cam_pos;
-    ae::vec4f sphere; // [x y z] = position, [w] = radius
+    ae::vec4f view; // [x y] = pixel size on the viewport, [z w] = viewport corner relative to its center
+    u32 bounds[4]; // Rendered band, [x0 y0 x1 y1] in frame pixels
+    f32 inv_height;
+    u32 padding[3];
 };
 static_assert(sizeof(push_constants) <= 128, "128 bytes is the guaranteed min size for push constants");
 
+// Prefixes the driver's pipeline cache data on disk. Drivers are supposed to reject foreign data on their
+// own, but not all of them do, so the blob is only handed over if it was written by the same device and
+// driver for the same shader.
+struct pipeline_cache_header {
+    u32 magic_;
+    u32 version_;
+    u32 vendor_id_;
+    u32 device_id_;
+    u32 driver_version_;
+    u32 reserved_;
+    u8 uuid_[VK_UUID_SIZE];
+    u64 shader_hash_;
+    u64 data_size_;
+    u64 data_hash_;
+};
+
+static constexpr u32 pipeline_cache_magic = 0x43504541; // "AEPC"
+static constexpr u32 pipeline_cache_version = 1;
+
+static u64 hash_bytes(const void *data, size_t size) {
+    const u8 *bytes = static_cast<const u8 *>(data);
+    u64 hash = 0xcbf29ce484222325ull;
+
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+// dxc can't tie numthreads to specialization constants without LocalSizeId (Vulkan 1.3), so the
+// workgroup size gets specialized by rewriting the LocalSize execution mode of the module instead
+static bool specialize_workgroup_size(std::vector<u32> &code, u32 width, u32 height) {
+    constexpr size_t header_words = 5;
+    constexpr u32 op_execution_mode = 16;
+    constexpr u32 execution_mode_local_size = 17;
+
+    for(size_t i = header_words; i < code.size();) {
+        const u32 word_count = code[i] >> 16;
+        const u32 opcode = code[i] & 0xffff;
+
+        if(word_count == 0 || (i + word_count) > code.size()) {
+            return false;
+        }
+
+        if(opcode == op_execution_mode && word_count == 6 && code[i + 2] == execution_mode_local_size) {
+            code[i + 3] = width;
+            code[i + 4] = height;
+            code[i + 5] = 1;
+            return true;
+        }
+
+        i += word_count;
+    }
+
+    return false;
+}
+
+// Id of the variable bound to the binding of descriptor set 0, 0 if the module doesn't declare it
+static u32 find_binding_variable(const std::vector<u32> &code, u32 binding) {
+    constexpr size_t header_words = 5;
+    constexpr u32 op_decorate = 71;
+    constexpr u32 decoration_binding = 33;
+    constexpr u32 decoration_descriptor_set = 34;
+
+    std::vector<u32> in_set_0;
+    std::vector<u32> with_binding;
+
+    for(size_t i = header_words; i < code.size();) {
+        const u32 word_count = code[i] >> 16;
+        const u32 opcode = code[i] & 0xffff;
+
+        if(word_count == 0 || (i + word_count) > code.size()) {
+            return 0;
+        }
+
+        if(opcode == op_decorate && word_count == 4) {
+            if(code[i + 2] == decoration_descriptor_set && code[i + 3] == 0) {
+                in_set_0.push_back(code[i + 1]);
+            } else if(code[i + 2] == decoration_binding && code[i + 3] == binding) {
+                with_binding.push_back(code[i + 1]);
+            }
+        }
+
+        i += word_count;
+    }
+
+    for(const u32 id : with_binding) {
+        if(std::find(in_set_0.begin(), in_set_0.end(), id) != in_set_0.end()) {
+            return id;
+        }
+    }
+
+    return 0;
+}
+
+// A module compiled from an older compute.hlsl would silently ignore the buffers the layout binds
+static bool declares_bindings(const std::vector<u32> &code, std::initializer_list<u32> bindings) {
+    return std::all_of(bindings.begin(), bindings.end(), [&code](u32 binding) {
+        return find_binding_variable(code, binding) != 0;
+    });
+}
+
+// Position of the instruction with the opcode that declares the id, 0 if there is none
+static size_t find_declaration(const std::vector<u32> &code, u32 opcode, size_t result_word, u32 min_words, u32 id) {
+    constexpr size_t header_words = 5;
+
+    for(size_t i = header_words; i < code.size() && id != 0;) {
+        const u32 word_count = code[i] >> 16;
+
+        if(word_count == 0 || (i + word_count) > code.size()) {
+            return 0;
+        }
+
+        if((code[i] & 0xffff) == opcode && word_count >= min_words && code[i + result_word] == id) {
+            return i;
+        }
+
+        i += word_count;
+    }
+
+    return 0;
+}
+
+// Whether the binding is an image array, like the layered output image of batched views
+static bool binding_is_image_array(const std::vector<u32> &code, u32 binding) {
+    constexpr u32 op_type_image = 25;
+    constexpr u32 op_type_pointer = 32;
+    constexpr u32 op_variable = 59;
+
+    // Variable -> pointer type -> image type
+    const size_t variable = find_declaration(code, op_variable, 2, 4, find_binding_variable(code, binding));
+    const size_t pointer = variable ? find_declaration(code, op_type_pointer, 1, 4, code[variable + 1]) : 0;
+    const size_t image = pointer ? find_declaration(code, op_type_image, 1, 9, code[pointer + 3]) : 0;
+
+    return image != 0 && code[image + 5] == 1; // Arrayed
+}
+
+static pipeline_cache_header make_pipeline_cache_header(VkPhysicalDevice physical_device,
+                                                        u64 shader_hash,
+                                                        const void *data,
+                                                        size_t size) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+    pipeline_cache_header header = {
+        .magic_ = pipeline_cache_magic,
+        .version_ = pipeline_cache_version,
+        .vendor_id_ = properties.vendorID,
+        .device_id_ = properties.deviceID,
+        .driver_version_ = properties.driverVersion,
+        .reserved_ = 0,
+        .uuid_ = {},
+        .shader_hash_ = shader_hash,
+        .data_size_ = size,
+        .data_hash_ = hash_bytes(data, size)
+    };
+
+    std::memcpy(header.uuid_, properties.pipelineCacheUUID, sizeof(header.uuid_));
+
+    return header;
+}
+
+// Device memory is accounted by hooking the allocation functions, which covers every allocation site
+static PFN_vkAllocateMemory untracked_allocate_memory = nullptr;
+static PFN_vkFreeMemory untracked_free_memory = nullptr;
+static std::mutex tracked_allocations_mutex;
+static std::unordered_map<VkDeviceMemory, VkDeviceSize> tracked_allocations;
+
+static VKAPI_ATTR VkResult VKAPI_CALL tracked_allocate_memory(VkDevice device,
+                                                              const VkMemoryAllocateInfo *allocate_info,
+                                                              const VkAllocationCallbacks *allocator,
+                                                              VkDeviceMemory *memory) {
+    const VkResult result = untracked_allocate_memory(device, allocate_info, allocator, memory);
+
+    if(result != VK_SUCCESS) {
+        return result;
+    }
+
+    // Imported host memory is an output mapping, which is accounted already
+    for(const VkBaseInStructure *next = static_cast<const VkBaseInStructure *>(allocate_info->pNext);
+        next;
+        next = next->pNext) {
+
+        if(next->sType == VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT) {
+            return result;
+        }
+    }
+
+    ae::memory_allocated(ae::memory_category::vulkan, allocate_info->allocationSize);
+
+    std::lock_guard lock(tracked_allocations_mutex);
+    tracked_allocations[*memory] = allocate_info->allocationSize;
+
+    return result;
+}
+
+static VKAPI_ATTR void VKAPI_CALL tracked_free_memory(VkDevice device,
+                                                      VkDeviceMemory memory,
+                                                      const VkAllocationCallbacks *allocator) {
+    {
+        std::lock_guard lock(tracked_allocations_mutex);
+
+        if(auto allocation = tracked_allocations.find(memory); allocation != tracked_allocations.end()) {
+            ae::memory_freed(ae::memory_category::vulkan, allocation->second);
+            tracked_allocations.erase(allocation);
+        }
+    }
+
+    untracked_free_memory(device, memory, allocator);
+}
+
 #ifdef AE_DEBUG
 static const char * get_property_name(const VkLayerProperties &layer) { return layer.layerName; }
 static const char * get_property_name(const VkExtensionProperties &extension) { return extension.extensionName; }
@@ -82,6 +317,13 @@ public:
             == VK_SUCCESS;
     }
 
+    // Hands ownership to the caller
+    THandle release() {
+        THandle handle = handle_;
+        handle_ = VK_NULL_HANDLE;
+        return handle;
+    }
+
     operator bool() const { return handle_ != VK_NULL_HANDLE; }
     explicit operator THandle() { return handle_; }
     THandle operator*() { return handle_; }
@@ -98,6 +340,8 @@ void * vulkan_raytracer::lib_ = nullptr;
 
 bool vulkan_raytracer::init() {
     if(!lib_) {
+        const u64 load_start = ae::system_time_ns();
+
         lib_ =
 #ifdef AE_PLATFORM_WIN32
             LoadLibraryW(L"vulkan-1.dll")
@@ -105,6 +349,8 @@ bool vulkan_raytracer::init() {
             dlopen("libvulkan.so.1", RTLD_NOW)
 #endif
         ;
+
+        ae::stats_record("startup", "vulkan_load_library", ae::stats_elapsed_ms(load_start));
     }
 
     return lib_ != nullptr;
@@ -133,20 +379,46 @@ vulkan_raytracer::~vulkan_raytracer() {
         } \
     } while(0)
 
-    AE_VULKAN_SAFE_DELETE(vkFreeCommandBuffers, command_buffer_,
-                          device_, command_pool_, 1, &command_buffer_);
+    if(device_ != VK_NULL_HANDLE && vkDeviceWaitIdle) {
+        vkDeviceWaitIdle(device_);
+
+        for(imported_destination &import : imports_) {
+            release_import(import);
+        }
+
+        imports_.clear();
+
+        for(frame_slot &slot : slots_) {
+            destroy_frame_resources(slot);
+
+            AE_VULKAN_SAFE_DELETE(vkDestroyFence, slot.fence_,
+                                  device_, slot.fence_, nullptr);
+            AE_VULKAN_SAFE_DELETE(vkFreeCommandBuffers, slot.command_buffer_,
+                                  device_, command_pool_, 1, &slot.command_buffer_);
+        }
+    }
+    AE_VULKAN_SAFE_DELETE(vkDestroyQueryPool, query_pool_,
+                          device_, query_pool_, nullptr);
+    AE_VULKAN_SAFE_DELETE(vkDestroyBuffer, scene_buffer_,
+                          device_, scene_buffer_, nullptr);
+    AE_VULKAN_SAFE_DELETE(vkFreeMemory, scene_memory_,
+                          device_, scene_memory_, nullptr);
     AE_VULKAN_SAFE_DELETE(vkDestroyCommandPool, command_pool_,
                           device_, command_pool_, nullptr);
-    AE_VULKAN_SAFE_DELETE(vkDestroyShaderModule, compute_shader_module_,
-                          device_, compute_shader_module_, nullptr);
+    for(pipeline_variant &variant : pipelines_) {
+        AE_VULKAN_SAFE_DELETE(vkDestroyPipeline, variant.pipeline_,
+                              device_, variant.pipeline_, nullptr);
+        AE_VULKAN_SAFE_DELETE(vkDestroyShaderModule, variant.shader_module_,
+                              device_, variant.shader_module_, nullptr);
+    }
     AE_VULKAN_SAFE_DELETE(vkDestroyDescriptorSetLayout, descriptor_set_layout_,
                           device_, descriptor_set_layout_, nullptr);
     AE_VULKAN_SAFE_DELETE(vkDestroyDescriptorPool, descriptor_pool_,
                           device_, descriptor_pool_, nullptr);
     AE_VULKAN_SAFE_DELETE(vkDestroyPipelineLayout, pipeline_layout_,
                           device_, pipeline_layout_, nullptr);
-    AE_VULKAN_SAFE_DELETE(vkDestroyPipeline, pipeline_,
-                          device_, pipeline_, nullptr);
+    AE_VULKAN_SAFE_DELETE(vkDestroyPipelineCache, pipeline_cache_,
+                          device_, pipeline_cache_, nullptr);
     AE_VULKAN_SAFE_DELETE(vkDestroyDevice, device_,
                           device_, nullptr);
     AE_VULKAN_SAFE_DELETE(vkDestroyInstance, instance_,
@@ -156,126 +428,146 @@ vulkan_raytracer::~vulkan_raytracer() {
 }
 
 bool vulkan_raytracer::setup() {
-    return lib_
-        && load_functions()
-        && create_pipeline()
-        && create_command_handles();
-}
+    AE_TRACE_SCOPE("vulkan setup");
 
-void vulkan_raytracer::trace() {
-    auto [w, h] = raytracer::get_resolution();
+    const ae::command_handler::variant frames_in_flight = ae::command_handler::get().value("frames-in-flight"_hash);
 
-    vulkan_handle<VkImage, VkDevice, decltype(vkDestroyImage)>
-        image(create_image(w, h), device_, vkDestroyImage);
+    slots_.resize(std::holds_alternative<u32>(frames_in_flight)
+                      ? ae::clamp(std::get<u32>(frames_in_flight), 1u, max_frames_in_flight)
+                      : 2);
 
-    if(!image) {
-        return;
+    if(!lib_ || !load_functions()) {
+        return false;
     }
 
-    VkMemoryRequirements memory_requirements;
-    vkGetImageMemoryRequirements(device_, *image, &memory_requirements);
+    u64 phase_start = ae::system_time_ns();
 
-    const VkMemoryAllocateInfo allocate_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memory_requirements.size,
-        .memoryTypeIndex = [this](const VkMemoryRequirements &requirements) {
-            VkPhysicalDeviceMemoryProperties memory_properties;
-            vkGetPhysicalDeviceMemoryProperties(physical_device_, &memory_properties);
+    if(!create_pipeline()) {
+        return false;
+    }
 
-            constexpr u32 required_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    ae::stats_record("vulkan setup", "create_pipeline", ae::stats_elapsed_ms(phase_start));
+    phase_start = ae::system_time_ns();
 
-            for(u32 i = 0; i < memory_properties.memoryTypeCount; i++) {
-                if((requirements.memoryTypeBits & (1 << i))
-                   && ((memory_properties.memoryTypes[i].propertyFlags & required_flags) == required_flags)) {
-                    return i;
-                }
-            }
+    if(!create_command_handles()) {
+        return false;
+    }
 
-            return static_cast<u32>(-1);
-        }(memory_requirements)
-    };
+    create_query_pool();
 
-    vulkan_handle<VkDeviceMemory, VkDevice, decltype(vkFreeMemory)>
-        device_memory(device_, vkFreeMemory);
+    ae::stats_record("vulkan setup", "create_command_handles", ae::stats_elapsed_ms(phase_start));
+    phase_start = ae::system_time_ns();
 
-    if(allocate_info.memoryTypeIndex == static_cast<u32>(-1)
-       || !device_memory.create(vkAllocateMemory, &allocate_info)
-       || (vkBindImageMemory(device_, *image, *device_memory, 0) != VK_SUCCESS)) {
-        return;
+    if(!upload_scene(ae::scene::build_test_scene())) {
+        return false;
     }
 
-    vulkan_handle<VkImageView, VkDevice, decltype(vkDestroyImageView)>
-        image_view(create_image_view(*image), device_, vkDestroyImageView);
+    ae::stats_record("vulkan setup", "upload_scene", ae::stats_elapsed_ms(phase_start));
 
-    if(!image_view) {
-        return;
+    // trace() renders into the same buffer every time, without an import collect() copies it there
+    if(framebuffer_) {
+        const raytracer::region region = raytracer::get_region();
+        import_destination(framebuffer_, static_cast<size_t>(region.width_) * region.height_ * sizeof(u32));
     }
 
-    const VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = descriptor_pool_,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &descriptor_set_layout_
+    return true;
+}
+
+bool vulkan_raytracer::trace() {
+    return submit(framebuffer_) && collect(framebuffer_);
+}
+
+bool vulkan_raytracer::submit(u32 *destination) {
+    return submit(destination, raytracer::get_region());
+}
+
+bool vulkan_raytracer::submit(u32 *destination, const ae::raytracer::region &band) {
+    const view current_view = {
+        .camera_pos_ = raytracer::camera_pos,
+        .scene_offset_ = raytracer::scene_offset
     };
 
-    VkDescriptorSet descriptor_set;
-    if(vkAllocateDescriptorSets(device_, &descriptor_set_allocate_info, &descriptor_set) != VK_SUCCESS) {
-        return;
+    return submit(std::span(&current_view, 1), destination, band);
+}
+
+bool vulkan_raytracer::submit_views(std::span<const view> views) {
+    return submit(views, nullptr, raytracer::get_region());
+}
+
+bool vulkan_raytracer::submit(std::span<const view> views, u32 *destination, const ae::raytracer::region &band) {
+    AE_TRACE_SCOPE("vulkan submit");
+
+    const raytracer::region region = raytracer::get_region();
+
+    if(pending_frames_ == slots_.size()
+       || views.empty() || views.size() > max_batch_views
+       || band.width_ == 0 || band.height_ == 0
+       || band.x_ < region.x_ || band.y_ < region.y_
+       || (band.x_ + band.width_) > (region.x_ + region.width_)
+       || (band.y_ + band.height_) > (region.y_ + region.height_)) {
+        return false;
     }
 
-    const VkDescriptorImageInfo descriptor_image_info = {
-        .sampler = VK_NULL_HANDLE,
-        .imageView = *image_view,
-        .imageLayout = VK_IMAGE_LAYOUT_GENERAL
-    };
+    const u64 submit_start = ae::system_time_ns();
 
-    const VkWriteDescriptorSet write_descriptor_sets[] = {
-        {
-            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = descriptor_set,
-            .dstBinding = 0,
-            .dstArrayElement = 0,
-            .descriptorCount = 1,
-            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-            .pImageInfo = &descriptor_image_info
-        }
-    };
+    auto [w, h] = raytracer::get_resolution();
+    frame_slot &slot = slots_[next_slot_];
+    const u32 first_query = next_slot_ * timestamps_per_frame;
 
-    vkUpdateDescriptorSets(device_,
-                           AE_ARRAY_COUNT(write_descriptor_sets),
-                           write_descriptor_sets,
-                           0,
-                           nullptr);
+    const u32 view_count = static_cast<u32>(views.size());
+
+    // Smaller batches reuse the layers of a larger one
+    if((slot.resources_.width_ != w || slot.resources_.height_ != h || slot.resources_.layers_ < view_count)
+       && !create_frame_resources(slot, w, h, view_count)) {
+        return false;
+    }
+
+    // The slot's previous frame has been collected, so the device is done reading the views
+    std::memcpy(slot.resources_.views_, views.data(), views.size_bytes());
+
+    const pipeline_variant *variant = find_pipeline(group_width_, group_height_);
+
+    if(!variant) {
+        return false;
+    }
 
     // Command buffer recording
     const VkCommandBufferBeginInfo command_buffer_begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
     };
-    vkBeginCommandBuffer(command_buffer_, &command_buffer_begin_info);
+    vkBeginCommandBuffer(slot.command_buffer_, &command_buffer_begin_info);
+
+    if(query_pool_ != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(slot.command_buffer_, query_pool_, first_query, timestamps_per_frame);
+        vkCmdWriteTimestamp(slot.command_buffer_, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool_, first_query);
+    }
 
-    vkCmdBindPipeline(command_buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+    vkCmdBindPipeline(slot.command_buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, variant->pipeline_);
 
+    const VkImageSubresourceRange subresource_range = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel = 0,
+        .levelCount = 1,
+        .baseArrayLayer = 0,
+        .layerCount = VK_REMAINING_ARRAY_LAYERS
+    };
+
+    // The previous contents are always overwritten, so the image can be discarded every frame
     const VkImageMemoryBarrier image_barrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
-        .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
         .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
         .newLayout = VK_IMAGE_LAYOUT_GENERAL,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .image = *image,
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1
-        }
+        .image = slot.resources_.image_,
+        .subresourceRange = subresource_range
     };
 
-    vkCmdPipelineBarrier(command_buffer_,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+    vkCmdPipelineBarrier(slot.command_buffer_,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
                          0,
                          0,
@@ -285,103 +577,659 @@ void vulkan_raytracer::trace() {
                          1,
                          &image_barrier);
 
+    // The viewport is 1 unit along the shorter side of the image and centered on the view direction
+    const f32 width = static_cast<f32>(w);
+    const f32 height = static_cast<f32>(h);
+    const f32 viewport_width = (w > h) ? (width / height) : 1.0f;
+    const f32 viewport_height = (w > h) ? 1.0f : (height / width);
+
     push_constants pc = {
         .bg0 = raytracer::background0,
         .bg1 = raytracer::background1,
-        .cam_pos = raytracer::camera_pos,
-        .sphere = ae::vec4f(raytracer::sphere.center_.x_,
-                            raytracer::sphere.center_.y_,
-                            raytracer::sphere.center_.z_,
-                            raytracer::sphere.radius_)
+        .view = ae::vec4f(viewport_width / width,
+                          viewport_height / height,
+                          viewport_width * -0.5f,
+                          viewport_height * -0.5f),
+        .bounds = { band.x_, band.y_, band.x_ + band.width_, band.y_ + band.height_ },
+        .inv_height = 1.0f / height,
+        .padding = {}
     };
 
-    vkCmdPushConstants(command_buffer_, pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
-    vkCmdBindDescriptorSets(command_buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout_, 0, 1, &descriptor_set, 0, nullptr);
-    vkCmdDispatch(command_buffer_, w / 16, h / 16, 1);
+    vkCmdPushConstants(slot.command_buffer_, pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+    vkCmdBindDescriptorSets(slot.command_buffer_, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout_, 0, 1, &slot.descriptor_set_, 0, nullptr);
 
-    vkEndCommandBuffer(command_buffer_);
+    // Partial groups along the edges are masked off in the shader
+    vkCmdDispatch(slot.command_buffer_,
+                  (band.width_ + group_width_ - 1) / group_width_,
+                  (band.height_ + group_height_ - 1) / group_height_,
+                  view_count);
 
-    // Queue submission
-    const VkSubmitInfo submit_info = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &command_buffer_
+    if(query_pool_ != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(slot.command_buffer_, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, query_pool_, first_query + 1);
+    }
+
+    const VkImageMemoryBarrier copy_barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = slot.resources_.image_,
+        .subresourceRange = subresource_range
+    };
+
+    vkCmdPipelineBarrier(slot.command_buffer_,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         &copy_barrier);
+
+    // Only the band is rendered and copied out, tightly packed, with the views one after another
+    const VkBufferImageCopy copy_region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = view_count
+        },
+        .imageOffset = {
+            .x = static_cast<i32>(band.x_),
+            .y = static_cast<i32>(band.y_),
+            .z = 0
+        },
+        .imageExtent = {
+            .width = band.width_,
+            .height = band.height_,
+            .depth = 1
+        }
     };
 
-    vulkan_handle<VkFence, VkDevice, decltype(vkDestroyFence)>
-        fence(device_, vkDestroyFence);
+    vkCmdCopyImageToBuffer(slot.command_buffer_,
+                           slot.resources_.image_,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           slot.resources_.readback_buffer_,
+                           1,
+                           &copy_region);
+
+    const VkDeviceSize band_size = static_cast<VkDeviceSize>(band.width_) * band.height_ * sizeof(u32);
+    VkBuffer host_buffer = slot.resources_.readback_buffer_;
+    u32 *written = nullptr;
+
+    // Image copies need texel aligned offsets, the pixels in an output file usually aren't,
+    // so the imported destination is filled from the readback buffer instead of the image.
+    // Batches are read back as a whole, they only have one destination per view.
+    if(const imported_destination *import = (view_count == 1) ? find_import(destination, band_size) : nullptr) {
+        written = destination;
+
+        const VkBufferMemoryBarrier transfer_barrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = slot.resources_.readback_buffer_,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE
+        };
 
-    const VkFenceCreateInfo fence_create_info = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+        vkCmdPipelineBarrier(slot.command_buffer_,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0,
+                             0,
+                             nullptr,
+                             1,
+                             &transfer_barrier,
+                             0,
+                             nullptr);
+
+        const VkBufferCopy buffer_copy = {
+            .srcOffset = 0,
+            .dstOffset = import->offset_ + (reinterpret_cast<uintptr_t>(destination) - reinterpret_cast<uintptr_t>(import->target_)),
+            .size = band_size
+        };
+
+        vkCmdCopyBuffer(slot.command_buffer_, slot.resources_.readback_buffer_, import->buffer_, 1, &buffer_copy);
+
+        host_buffer = import->buffer_;
+    }
+
+    const VkBufferMemoryBarrier host_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = host_buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE
     };
 
-    if(!fence.create(vkCreateFence, &fence_create_info)) {
-        return;
+    vkCmdPipelineBarrier(slot.command_buffer_,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         1,
+                         &host_barrier,
+                         0,
+                         nullptr);
+
+    if(query_pool_ != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(slot.command_buffer_, VK_PIPELINE_STAGE_TRANSFER_BIT, query_pool_, first_query + 2);
     }
 
-    VkQueue queue;
-    vkGetDeviceQueue(device_, queue_family_index_, 0, &queue);
+    vkEndCommandBuffer(slot.command_buffer_);
 
-    vkQueueSubmit(queue, 1, &submit_info, *fence);
+    // Queue submission
+    const VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &slot.command_buffer_
+    };
 
-    VkFence fence_handle = static_cast<VkFence>(fence);
-    vkWaitForFences(device_, 1, &fence_handle, VK_TRUE, static_cast<u32>(-1));
+    if(vkResetFences(device_, 1, &slot.fence_) != VK_SUCCESS
+       || vkQueueSubmit(queue_, 1, &submit_info, slot.fence_) != VK_SUCCESS) {
+        return false;
+    }
 
-    assert(allocate_info.allocationSize == (w * h * 4));
+    slot.written_ = written;
+    slot.readback_size_ = band_size;
+    slot.view_count_ = view_count;
+    next_slot_ = (next_slot_ + 1) % slots_.size();
+    pending_frames_++;
 
-    void *data;
-    vkMapMemory(device_,
-                *device_memory,
-                0,
-                allocate_info.allocationSize,
-                0,
-                &data);
+    ae::stats_record("vulkan frame", "record_and_submit", ae::stats_elapsed_ms(submit_start));
 
-    std::memcpy(framebuffer_, data, allocate_info.allocationSize);
-    vkUnmapMemory(device_, *device_memory);
+    return true;
 }
 
-bool vulkan_raytracer::create_instance() {
-    u32 api_version;
-    vkEnumerateInstanceVersion(&api_version);
-
-#ifdef AE_DEBUG
-    std::vector<const char *> layers;
-    fill_supported_property_requests<VkLayerProperties, decltype(vkEnumerateInstanceLayerProperties)>
-        ({ "VK_LAYER_KHRONOS_validation" }, layers, vkEnumerateInstanceLayerProperties);
+bool vulkan_raytracer::collect(u32 *buffer) {
+    return collect_views(std::span(&buffer, 1));
+}
 
-    std::vector<const char *>extensions;
-    fill_supported_property_requests<VkExtensionProperties, decltype(vkEnumerateInstanceExtensionProperties)>
-        ({ VK_EXT_DEBUG_UTILS_EXTENSION_NAME }, extensions, vkEnumerateInstanceExtensionProperties, nullptr);
-#endif
+bool vulkan_raytracer::collect_views(std::span<u32 *const> buffers) {
+    if(pending_frames_ == 0) {
+        return false;
+    }
 
-    const u32 major = VK_API_VERSION_MAJOR(api_version);
-    const u32 minor = VK_API_VERSION_MINOR(api_version);
+    const u32 slot_count = static_cast<u32>(slots_.size());
+    const u32 slot_index = (next_slot_ + slot_count - pending_frames_) % slot_count;
+    frame_slot &slot = slots_[slot_index];
 
-    if(!(major > req_major_version || (major == req_major_version && minor >= req_minor_version))) {
+    if(buffers.size() != slot.view_count_) {
         return false;
     }
 
-    const VkApplicationInfo application_info = {
-        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-        .apiVersion = VK_MAKE_API_VERSION(0, req_major_version, req_minor_version, 0)
-    };
+    pending_frames_--;
 
-    const VkInstanceCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-        .pApplicationInfo = &application_info,
-#ifdef AE_DEBUG
-        .enabledLayerCount = static_cast<u32>(layers.size()),
-        .ppEnabledLayerNames = layers.data(),
-        .enabledExtensionCount = static_cast<u32>(extensions.size()),
-        .ppEnabledExtensionNames = extensions.data()
-#endif
-    };
+    const u64 wait_start = ae::system_time_ns();
 
-    return vkCreateInstance(&create_info, nullptr, &instance_) == VK_SUCCESS;
-}
+    {
+        AE_TRACE_SCOPE("vulkan fence wait");
 
-bool vulkan_raytracer::create_device() {
+        if(vkWaitForFences(device_, 1, &slot.fence_, VK_TRUE, static_cast<u64>(-1)) != VK_SUCCESS) {
+            return false;
+        }
+    }
+
+    ae::stats_record("vulkan frame", "fence_wait", ae::stats_elapsed_ms(wait_start));
+
+    if(query_pool_ != VK_NULL_HANDLE) {
+        u64 timestamps[timestamps_per_frame];
+
+        if(vkGetQueryPoolResults(device_,
+                                 query_pool_,
+                                 slot_index * timestamps_per_frame,
+                                 timestamps_per_frame,
+                                 sizeof(timestamps),
+                                 timestamps,
+                                 sizeof(u64),
+                                 VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+
+            auto to_ms = [this](u64 begin, u64 end) {
+                return static_cast<f64>((end - begin) & timestamp_mask_) * timestamp_period_ns_ / 1000000.0;
+            };
+
+            // Dispatch includes the layout transition in front of it, copy everything from the transition
+            // to the transfer layout up to the barrier that makes the results visible to the host
+            ae::stats_record("vulkan frame", "gpu_dispatch", to_ms(timestamps[0], timestamps[1]));
+            ae::stats_record("vulkan frame", "gpu_copy", to_ms(timestamps[1], timestamps[2]));
+        }
+    }
+
+    const bool written = slot.written_ && slot.written_ == buffers[0];
+    slot.written_ = nullptr;
+
+    // Counted so the stats show whether the imports are taken
+    if(written) {
+        ae::stats_record("vulkan frame", "written_by_device", 1.0, "");
+        ae::stats_first_pixel();
+        return true;
+    }
+
+    AE_TRACE_SCOPE("vulkan writeback");
+    const u64 writeback_start = ae::system_time_ns();
+
+    // The band is at the start of the readback buffer, which holds at most the region
+    if(!slot.resources_.readback_coherent_) {
+        const VkMappedMemoryRange range = {
+            .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .memory = slot.resources_.readback_memory_,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE
+        };
+
+        if(vkInvalidateMappedMemoryRanges(device_, 1, &range) != VK_SUCCESS) {
+            return false;
+        }
+    }
+
+    for(size_t i = 0; i < buffers.size(); i++) {
+        std::memcpy(buffers[i],
+                    static_cast<const std::byte *>(slot.resources_.mapping_) + i * slot.readback_size_,
+                    static_cast<size_t>(slot.readback_size_));
+    }
+
+    ae::stats_record("vulkan frame", "writeback", ae::stats_elapsed_ms(writeback_start));
+    ae::stats_first_pixel();
+
+    return true;
+}
+
+VkDeviceMemory vulkan_raytracer::allocate_memory(const VkMemoryRequirements &requirements,
+                                                 u32 preferred_flags,
+                                                 u32 fallback_flags,
+                                                 u32 &property_flags) const {
+    u32 memory_type = find_memory_type(requirements.memoryTypeBits, preferred_flags);
+    property_flags = preferred_flags;
+
+    if(memory_type == static_cast<u32>(-1)) {
+        memory_type = find_memory_type(requirements.memoryTypeBits, fallback_flags);
+        property_flags = fallback_flags;
+    }
+
+    const VkMemoryAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = requirements.size,
+        .memoryTypeIndex = memory_type
+    };
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+
+    if(memory_type == static_cast<u32>(-1)
+       || vkAllocateMemory(device_, &allocate_info, nullptr, &memory) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+
+    return memory;
+}
+
+bool vulkan_raytracer::create_frame_resources(frame_slot &slot, u32 width, u32 height, u32 layers) {
+    destroy_frame_resources(slot);
+
+    vulkan_handle<VkImage, VkDevice, decltype(vkDestroyImage)>
+        image(create_image(width, height, layers), device_, vkDestroyImage);
+
+    if(!image) {
+        return false;
+    }
+
+    VkMemoryRequirements image_requirements;
+    vkGetImageMemoryRequirements(device_, *image, &image_requirements);
+
+    u32 image_memory_flags;
+
+    vulkan_handle<VkDeviceMemory, VkDevice, decltype(vkFreeMemory)>
+        image_memory(allocate_memory(image_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, image_memory_flags),
+                     device_,
+                     vkFreeMemory);
+
+    if(!image_memory || (vkBindImageMemory(device_, *image, *image_memory, 0) != VK_SUCCESS)) {
+        return false;
+    }
+
+    vulkan_handle<VkImageView, VkDevice, decltype(vkDestroyImageView)>
+        image_view(create_image_view(*image, layers), device_, vkDestroyImageView);
+
+    if(!image_view) {
+        return false;
+    }
+
+    const raytracer::region region = raytracer::get_region();
+    const VkDeviceSize readback_size = static_cast<VkDeviceSize>(region.width_) * region.height_ * sizeof(u32) * layers;
+
+    vulkan_handle<VkBuffer, VkDevice, decltype(vkDestroyBuffer)>
+        readback_buffer(create_buffer(readback_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT), device_, vkDestroyBuffer);
+
+    if(!readback_buffer) {
+        return false;
+    }
+
+    VkMemoryRequirements readback_requirements;
+    vkGetBufferMemoryRequirements(device_, *readback_buffer, &readback_requirements);
+
+    // Cached memory makes the CPU reads fast, but it usually isn't coherent and needs an invalidate
+    u32 readback_memory_flags;
+
+    vulkan_handle<VkDeviceMemory, VkDevice, decltype(vkFreeMemory)>
+        readback_memory(allocate_memory(readback_requirements,
+                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                        readback_memory_flags),
+                        device_,
+                        vkFreeMemory);
+
+    void *mapping = nullptr;
+
+    if(!readback_memory
+       || (vkBindBufferMemory(device_, *readback_buffer, *readback_memory, 0) != VK_SUCCESS)
+       || (vkMapMemory(device_, *readback_memory, 0, VK_WHOLE_SIZE, 0, &mapping) != VK_SUCCESS)) {
+        return false;
+    }
+
+    // The cameras are rewritten by every submit, so they stay in host memory that the shader reads directly
+    const VkDeviceSize view_size = sizeof(view) * layers;
+
+    vulkan_handle<VkBuffer, VkDevice, decltype(vkDestroyBuffer)>
+        view_buffer(create_buffer(view_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT), device_, vkDestroyBuffer);
+
+    if(!view_buffer) {
+        return false;
+    }
+
+    VkMemoryRequirements view_requirements;
+    vkGetBufferMemoryRequirements(device_, *view_buffer, &view_requirements);
+
+    u32 view_memory_flags;
+
+    vulkan_handle<VkDeviceMemory, VkDevice, decltype(vkFreeMemory)>
+        view_memory(allocate_memory(view_requirements,
+                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                    0,
+                                    view_memory_flags),
+                    device_,
+                    vkFreeMemory);
+
+    void *view_mapping = nullptr;
+
+    if(!view_memory
+       || (vkBindBufferMemory(device_, *view_buffer, *view_memory, 0) != VK_SUCCESS)
+       || (vkMapMemory(device_, *view_memory, 0, VK_WHOLE_SIZE, 0, &view_mapping) != VK_SUCCESS)) {
+        return false;
+    }
+
+    // The descriptor set outlives the frame resources, it only needs to point at the new image and views
+    const VkDescriptorImageInfo descriptor_image_info = {
+        .sampler = VK_NULL_HANDLE,
+        .imageView = *image_view,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL
+    };
+
+    const VkDescriptorBufferInfo descriptor_view_info = {
+        .buffer = *view_buffer,
+        .offset = 0,
+        .range = view_size
+    };
+
+    const VkWriteDescriptorSet write_descriptor_sets[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = slot.descriptor_set_,
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .pImageInfo = &descriptor_image_info
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = slot.descriptor_set_,
+            .dstBinding = view_binding,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &descriptor_view_info
+        }
+    };
+
+    vkUpdateDescriptorSets(device_,
+                           AE_ARRAY_COUNT(write_descriptor_sets),
+                           write_descriptor_sets,
+                           0,
+                           nullptr);
+
+    slot.resources_ = {
+        .image_ = image.release(),
+        .image_memory_ = image_memory.release(),
+        .image_view_ = image_view.release(),
+        .readback_buffer_ = readback_buffer.release(),
+        .readback_memory_ = readback_memory.release(),
+        .view_buffer_ = view_buffer.release(),
+        .view_memory_ = view_memory.release(),
+        .mapping_ = mapping,
+        .views_ = static_cast<view *>(view_mapping),
+        .width_ = width,
+        .height_ = height,
+        .layers_ = layers,
+        .readback_coherent_ = (readback_memory_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0
+    };
+
+    return true;
+}
+
+bool vulkan_raytracer::import_destination(u32 *destination, size_t size) {
+    // Larger alignments could reach past the pages backing the destination
+    constexpr VkDeviceSize max_alignment = 4096;
+
+    if(!destination || size == 0 || host_pointer_alignment_ == 0 || host_pointer_alignment_ > max_alignment || !vkGetMemoryHostPointerPropertiesEXT) {
+        return false;
+    }
+
+    // Output files are mapped at page boundaries, so rounding out to the import alignment stays inside the mapping
+    const uintptr_t address = reinterpret_cast<uintptr_t>(destination);
+    const uintptr_t begin = address & ~static_cast<uintptr_t>(host_pointer_alignment_ - 1);
+    const uintptr_t end = (address + size + host_pointer_alignment_ - 1) & ~static_cast<uintptr_t>(host_pointer_alignment_ - 1);
+    void *host_pointer = reinterpret_cast<void *>(begin);
+
+    VkMemoryHostPointerPropertiesEXT pointer_properties = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT
+    };
+
+    if(vkGetMemoryHostPointerPropertiesEXT(device_,
+                                           VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+                                           host_pointer,
+                                           &pointer_properties) != VK_SUCCESS) {
+        return false;
+    }
+
+    const VkExternalMemoryBufferCreateInfo external_buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT
+    };
+
+    vulkan_handle<VkBuffer, VkDevice, decltype(vkDestroyBuffer)>
+        buffer(create_buffer(end - begin, VK_BUFFER_USAGE_TRANSFER_DST_BIT, &external_buffer_info), device_, vkDestroyBuffer);
+
+    if(!buffer) {
+        return false;
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device_, *buffer, &requirements);
+
+    // The imported memory never gets mapped or invalidated, so only coherent memory will do
+    const VkImportMemoryHostPointerInfoEXT import_info = {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+        .pHostPointer = host_pointer
+    };
+
+    const VkMemoryAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = &import_info,
+        .allocationSize = end - begin,
+        .memoryTypeIndex = find_memory_type(requirements.memoryTypeBits & pointer_properties.memoryTypeBits,
+                                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+    };
+
+    vulkan_handle<VkDeviceMemory, VkDevice, decltype(vkFreeMemory)>
+        memory(device_, vkFreeMemory);
+
+    if(allocate_info.memoryTypeIndex == static_cast<u32>(-1)
+       || requirements.size > allocate_info.allocationSize
+       || !memory.create(vkAllocateMemory, &allocate_info)
+       || (vkBindBufferMemory(device_, *buffer, *memory, 0) != VK_SUCCESS)) {
+        return false;
+    }
+
+    imports_.push_back({
+        .buffer_ = buffer.release(),
+        .memory_ = memory.release(),
+        .offset_ = address - begin,
+        .size_ = size,
+        .target_ = destination
+    });
+
+    return true;
+}
+
+void vulkan_raytracer::release_destination(const u32 *destination) {
+    auto import = std::find_if(imports_.begin(), imports_.end(), [destination](const imported_destination &i) {
+        return i.target_ == destination;
+    });
+
+    if(import != imports_.end()) {
+        release_import(*import);
+        imports_.erase(import);
+    }
+}
+
+const vulkan_raytracer::imported_destination * vulkan_raytracer::find_import(const u32 *destination, VkDeviceSize size) const {
+    const uintptr_t address = reinterpret_cast<uintptr_t>(destination);
+
+    for(const imported_destination &import : imports_) {
+        const uintptr_t target = reinterpret_cast<uintptr_t>(import.target_);
+
+        if(destination && address >= target && (address - target) + size <= import.size_) {
+            return &import;
+        }
+    }
+
+    return nullptr;
+}
+
+void vulkan_raytracer::release_import(imported_destination &import) {
+    if(import.buffer_ != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device_, import.buffer_, nullptr);
+    }
+
+    if(import.memory_ != VK_NULL_HANDLE) {
+        vkFreeMemory(device_, import.memory_, nullptr);
+    }
+
+    import = {};
+}
+
+void vulkan_raytracer::destroy_frame_resources(frame_slot &slot) {
+    frame_resources &resources = slot.resources_;
+
+    if(resources.mapping_) {
+        vkUnmapMemory(device_, resources.readback_memory_);
+    }
+
+    if(resources.views_) {
+        vkUnmapMemory(device_, resources.view_memory_);
+    }
+
+    if(resources.view_buffer_ != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device_, resources.view_buffer_, nullptr);
+    }
+
+    if(resources.view_memory_ != VK_NULL_HANDLE) {
+        vkFreeMemory(device_, resources.view_memory_, nullptr);
+    }
+
+    if(resources.readback_buffer_ != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device_, resources.readback_buffer_, nullptr);
+    }
+
+    if(resources.readback_memory_ != VK_NULL_HANDLE) {
+        vkFreeMemory(device_, resources.readback_memory_, nullptr);
+    }
+
+    if(resources.image_view_ != VK_NULL_HANDLE) {
+        vkDestroyImageView(device_, resources.image_view_, nullptr);
+    }
+
+    if(resources.image_ != VK_NULL_HANDLE) {
+        vkDestroyImage(device_, resources.image_, nullptr);
+    }
+
+    if(resources.image_memory_ != VK_NULL_HANDLE) {
+        vkFreeMemory(device_, resources.image_memory_, nullptr);
+    }
+
+    resources = {};
+}
+
+bool vulkan_raytracer::create_instance() {
+    u32 api_version;
+    vkEnumerateInstanceVersion(&api_version);
+
+#ifdef AE_DEBUG
+    std::vector<const char *> layers;
+    fill_supported_property_requests<VkLayerProperties, decltype(vkEnumerateInstanceLayerProperties)>
+        ({ "VK_LAYER_KHRONOS_validation" }, layers, vkEnumerateInstanceLayerProperties);
+
+    std::vector<const char *>extensions;
+    fill_supported_property_requests<VkExtensionProperties, decltype(vkEnumerateInstanceExtensionProperties)>
+        ({ VK_EXT_DEBUG_UTILS_EXTENSION_NAME }, extensions, vkEnumerateInstanceExtensionProperties, nullptr);
+#endif
+
+    const u32 major = VK_API_VERSION_MAJOR(api_version);
+    const u32 minor = VK_API_VERSION_MINOR(api_version);
+
+    if(!(major > req_major_version || (major == req_major_version && minor >= req_minor_version))) {
+        return false;
+    }
+
+    // 1.1 is optional, it provides vkGetPhysicalDeviceProperties2 for querying extension limits
+    instance_api_version_ = (major > 1 || (major == 1 && minor >= 1))
+        ? VK_MAKE_API_VERSION(0, 1, 1, 0)
+        : VK_MAKE_API_VERSION(0, req_major_version, req_minor_version, 0);
+
+    const VkApplicationInfo application_info = {
+        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+        .apiVersion = instance_api_version_
+    };
+
+    const VkInstanceCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        .pApplicationInfo = &application_info,
+#ifdef AE_DEBUG
+        .enabledLayerCount = static_cast<u32>(layers.size()),
+        .ppEnabledLayerNames = layers.data(),
+        .enabledExtensionCount = static_cast<u32>(extensions.size()),
+        .ppEnabledExtensionNames = extensions.data()
+#endif
+    };
+
+    return vkCreateInstance(&create_info, nullptr, &instance_) == VK_SUCCESS;
+}
+
+bool vulkan_raytracer::create_device() {
     u32 device_count = 0;
     if(vkEnumeratePhysicalDevices(instance_, &device_count, nullptr) == VK_SUCCESS) {
         std::vector<VkPhysicalDevice> physical_devices(device_count);
@@ -442,43 +1290,77 @@ bool vulkan_raytracer::create_device() {
         }
     };
 
+    // Importing host memory lets the readback land directly in the output file mapping
+    std::vector<const char *> extensions;
+
+    if(instance_api_version_ >= VK_MAKE_API_VERSION(0, 1, 1, 0) && vkGetPhysicalDeviceProperties2) {
+        u32 extension_count = 0;
+        vkEnumerateDeviceExtensionProperties(physical_device_, nullptr, &extension_count, nullptr);
+
+        std::vector<VkExtensionProperties> available_extensions(extension_count);
+        vkEnumerateDeviceExtensionProperties(physical_device_, nullptr, &extension_count, available_extensions.data());
+
+        auto is_available = [&available_extensions](const char *name) {
+            for(const VkExtensionProperties &extension : available_extensions) {
+                if(std::strcmp(extension.extensionName, name) == 0) {
+                    return true;
+                }
+            }
+
+            return false;
+        };
+
+        if(is_available(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) {
+            VkPhysicalDeviceExternalMemoryHostPropertiesEXT host_properties = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT
+            };
+
+            VkPhysicalDeviceProperties2 properties = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+                .pNext = &host_properties
+            };
+
+            vkGetPhysicalDeviceProperties2(physical_device_, &properties);
+
+            host_pointer_alignment_ = host_properties.minImportedHostPointerAlignment;
+            extensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+
+            // Core in 1.1, but the device might only support 1.0
+            if(is_available(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME)) {
+                extensions.push_back(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
+            }
+        }
+    }
+
     const VkDeviceCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .queueCreateInfoCount = AE_ARRAY_COUNT(queue_create_infos),
-        .pQueueCreateInfos = queue_create_infos
+        .pQueueCreateInfos = queue_create_infos,
+        .enabledExtensionCount = static_cast<u32>(extensions.size()),
+        .ppEnabledExtensionNames = extensions.data()
     };
 
     return vkCreateDevice(physical_device_, &create_info, nullptr, &device_) == VK_SUCCESS;
 }
 
 bool vulkan_raytracer::create_pipeline() {
-    std::FILE *shader_file = std::fopen("compute.spv", "rb");
-    if(shader_file) {
-        std::fseek(shader_file, 0, SEEK_END);
-        const size_t shader_buffer_size = std::ftell(shader_file);
-        std::rewind(shader_file);
-
-        std::vector<char> shader_buffer(shader_buffer_size);
-        std::fread(shader_buffer.data(),
-                   sizeof(decltype(shader_buffer)::value_type),
-                   shader_buffer_size,
-                   shader_file);
-
-        const VkShaderModuleCreateInfo shader_module_create_info = {
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .codeSize = shader_buffer_size,
-            .pCode = reinterpret_cast<const u32 *>(shader_buffer.data())
-        };
-
-        std::fclose(shader_file);
+#ifdef AE_EMBEDDED_SPIRV
+    // The generated array is made of bytes and isn't guaranteed to be aligned for pCode
+    shader_code_.resize(sizeof(compute_spirv) / sizeof(u32));
+    std::memcpy(shader_code_.data(), compute_spirv, shader_code_.size() * sizeof(u32));
+#endif
 
-        if(vkCreateShaderModule(device_, &shader_module_create_info, nullptr, &compute_shader_module_) != VK_SUCCESS) {
-            return false;
-        }
-    } else {
+    // The layered output image, the scene's primitives, BVH nodes and materials, then the cameras of the views
+    if(shader_code_.empty()
+       || !declares_bindings(shader_code_, { 0, 1, 2, 3, view_binding })
+       || !binding_is_image_array(shader_code_, 0)) {
         return false;
     }
 
+    // Without a cache the pipeline just gets compiled from scratch
+    create_pipeline_cache(hash_bytes(shader_code_.data(), shader_code_.size() * sizeof(u32)));
+
+    // The output image, the scene's primitives, BVH nodes and materials, then the cameras of the views
     const VkDescriptorSetLayoutBinding descriptor_set_layout_bindings[] = {
         {
             .binding = 0,
@@ -486,6 +1368,34 @@ bool vulkan_raytracer::create_pipeline() {
             .descriptorCount = 1,
             .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
             .pImmutableSamplers = nullptr
+        },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .pImmutableSamplers = nullptr
+        },
+        {
+            .binding = 2,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .pImmutableSamplers = nullptr
+        },
+        {
+            .binding = 3,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .pImmutableSamplers = nullptr
+        },
+        {
+            .binding = view_binding,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .pImmutableSamplers = nullptr
         }
     };
 
@@ -499,16 +1409,21 @@ bool vulkan_raytracer::create_pipeline() {
         return false;
     }
 
+    // One set per frame in flight
     const VkDescriptorPoolSize descriptor_pool_sizes[] = {
         {
             .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-            .descriptorCount = 1
+            .descriptorCount = static_cast<u32>(slots_.size())
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = static_cast<u32>(slots_.size()) * (scene_binding_count + 1)
         }
     };
 
     const VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .maxSets = 1,
+        .maxSets = static_cast<u32>(slots_.size()),
         .poolSizeCount = AE_ARRAY_COUNT(descriptor_pool_sizes),
         .pPoolSizes = descriptor_pool_sizes
     };
@@ -537,13 +1452,69 @@ bool vulkan_raytracer::create_pipeline() {
         return false;
     }
 
+    select_workgroup_size();
+
+    // Build the default variant right away, so the first frame doesn't have to wait for it
+    return find_pipeline(group_width_, group_height_) != nullptr;
+}
+
+void vulkan_raytracer::select_workgroup_size() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device_, &properties);
+
+    const VkPhysicalDeviceLimits &limits = properties.limits;
+
+    auto fits = [&limits](u32 size) {
+        return size <= limits.maxComputeWorkGroupSize[0]
+            && size <= limits.maxComputeWorkGroupSize[1]
+            && (size * size) <= limits.maxComputeWorkGroupInvocations;
+    };
+
+    // 16x16 unless the device can't run that many invocations per group. Every device supports 8x8.
+    const ae::command_handler::variant requested = ae::command_handler::get().value("workgroup-size"_hash);
+    u32 size = std::holds_alternative<u32>(requested) ? ae::clamp(std::get<u32>(requested), 1u, 32u) : 16;
+
+    while(size > 1 && !fits(size)) {
+        size /= 2;
+    }
+
+    group_width_ = size;
+    group_height_ = size;
+}
+
+const vulkan_raytracer::pipeline_variant * vulkan_raytracer::find_pipeline(u32 group_width, u32 group_height) {
+    for(const pipeline_variant &variant : pipelines_) {
+        if(variant.group_width_ == group_width && variant.group_height_ == group_height) {
+            return &variant;
+        }
+    }
+
+    std::vector<u32> code = shader_code_;
+
+    if(!specialize_workgroup_size(code, group_width, group_height)) {
+        return nullptr;
+    }
+
+    const VkShaderModuleCreateInfo shader_module_create_info = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = code.size() * sizeof(u32),
+        .pCode = code.data()
+    };
+
+    vulkan_handle<VkShaderModule, VkDevice, decltype(vkDestroyShaderModule)>
+        shader_module(device_, vkDestroyShaderModule);
+
+    if(!shader_module.create(vkCreateShaderModule, &shader_module_create_info)) {
+        return nullptr;
+    }
+
     const VkComputePipelineCreateInfo create_infos[] = {
         {
             .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
             .stage = {
                 .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
                 .stage = VK_SHADER_STAGE_COMPUTE_BIT,
-                .module = compute_shader_module_,
+                .module = *shader_module,
                 .pName = "main",
                 .pSpecializationInfo = nullptr
             },
@@ -553,17 +1524,138 @@ bool vulkan_raytracer::create_pipeline() {
         }
     };
 
-    return vkCreateComputePipelines(device_,
-                                    VK_NULL_HANDLE,
-                                    AE_ARRAY_COUNT(create_infos),
-                                    create_infos,
-                                    nullptr,
-                                    &pipeline_) == VK_SUCCESS;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+
+    if(vkCreateComputePipelines(device_,
+                                pipeline_cache_,
+                                AE_ARRAY_COUNT(create_infos),
+                                create_infos,
+                                nullptr,
+                                &pipeline) != VK_SUCCESS) {
+        return nullptr;
+    }
+
+    save_pipeline_cache();
+
+    pipelines_.push_back({
+        .group_width_ = group_width,
+        .group_height_ = group_height,
+        .shader_module_ = shader_module.release(),
+        .pipeline_ = pipeline
+    });
+
+    return &pipelines_.back();
+}
+
+void vulkan_raytracer::create_pipeline_cache(u64 shader_hash) {
+    const ae::command_handler::variant cache_dir = ae::command_handler::get().value("cache-dir"_hash);
+    const std::string directory = std::holds_alternative<std::string>(cache_dir)
+        ? std::get<std::string>(cache_dir)
+        : ae::system_cache_directory();
+
+    if(directory.empty()) {
+        return;
+    }
+
+    pipeline_cache_path_ = directory + "/pipeline_cache.bin";
+    shader_hash_ = shader_hash;
+
+    std::vector<u8> blob;
+
+    if(std::FILE *file = std::fopen(pipeline_cache_path_.c_str(), "rb"); file) {
+        std::fseek(file, 0, SEEK_END);
+        const long size = std::ftell(file);
+        std::rewind(file);
+
+        blob.resize((size > 0) ? static_cast<size_t>(size) : 0);
+
+        if(std::fread(blob.data(), 1, blob.size(), file) != blob.size()) {
+            blob.clear();
+        }
+
+        std::fclose(file);
+    }
+
+    // Anything stale or damaged is simply ignored and overwritten once the pipeline is built
+    const pipeline_cache_header expected = make_pipeline_cache_header(physical_device_, shader_hash_, nullptr, 0);
+    pipeline_cache_header header;
+
+    if(blob.size() >= sizeof(header)) {
+        std::memcpy(&header, blob.data(), sizeof(header));
+    }
+
+    const bool valid = blob.size() >= sizeof(header)
+        && header.magic_ == expected.magic_
+        && header.version_ == expected.version_
+        && header.vendor_id_ == expected.vendor_id_
+        && header.device_id_ == expected.device_id_
+        && header.driver_version_ == expected.driver_version_
+        && std::memcmp(header.uuid_, expected.uuid_, sizeof(header.uuid_)) == 0
+        && header.shader_hash_ == expected.shader_hash_
+        && header.data_size_ == (blob.size() - sizeof(header))
+        && header.data_hash_ == hash_bytes(blob.data() + sizeof(header), blob.size() - sizeof(header));
+
+    const VkPipelineCacheCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = valid ? (blob.size() - sizeof(header)) : 0,
+        .pInitialData = valid ? (blob.data() + sizeof(header)) : nullptr
+    };
+
+    if(vkCreatePipelineCache(device_, &create_info, nullptr, &pipeline_cache_) == VK_SUCCESS) {
+        pipeline_cache_loaded_size_ = create_info.initialDataSize;
+    } else {
+        pipeline_cache_ = VK_NULL_HANDLE;
+    }
+}
+
+void vulkan_raytracer::save_pipeline_cache() {
+    if(pipeline_cache_ == VK_NULL_HANDLE) {
+        return;
+    }
+
+    size_t size = 0;
+
+    if(vkGetPipelineCacheData(device_, pipeline_cache_, &size, nullptr) != VK_SUCCESS || size == 0) {
+        return;
+    }
+
+    // Nothing got compiled that wasn't already cached
+    if(size == pipeline_cache_loaded_size_) {
+        return;
+    }
+
+    std::vector<u8> data(size);
+
+    if(vkGetPipelineCacheData(device_, pipeline_cache_, &size, data.data()) != VK_SUCCESS) {
+        return;
+    }
+
+    const pipeline_cache_header header = make_pipeline_cache_header(physical_device_, shader_hash_, data.data(), size);
+
+    // Concurrent jobs might be saving at the same time, each of them writes its own temporary file
+    const std::string temp_path = pipeline_cache_path_ + "." + std::to_string(ae::system_time_ns()) + ".tmp";
+    std::FILE *file = std::fopen(temp_path.c_str(), "wb");
+
+    if(!file) {
+        return;
+    }
+
+    const bool written = std::fwrite(&header, sizeof(header), 1, file) == 1
+        && std::fwrite(data.data(), 1, size, file) == size;
+
+    if((std::fclose(file) != 0) || !written || !ae::system_replace_file(temp_path.c_str(), pipeline_cache_path_.c_str())) {
+        std::remove(temp_path.c_str());
+        return;
+    }
+
+    pipeline_cache_loaded_size_ = size;
 }
 
 bool vulkan_raytracer::create_command_handles() {
+    // Command buffers get re-recorded for every frame
     const VkCommandPoolCreateInfo command_pool_create_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
         .queueFamilyIndex = queue_family_index_
     };
 
@@ -578,10 +1670,236 @@ bool vulkan_raytracer::create_command_handles() {
         .commandBufferCount = 1
     };
 
-    return vkAllocateCommandBuffers(device_, &allocate_info, &command_buffer_) == VK_SUCCESS;
+    const VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = descriptor_pool_,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &descriptor_set_layout_
+    };
+
+    const VkFenceCreateInfo fence_create_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+    };
+
+    for(frame_slot &slot : slots_) {
+        if(vkAllocateCommandBuffers(device_, &allocate_info, &slot.command_buffer_) != VK_SUCCESS
+           || vkAllocateDescriptorSets(device_, &descriptor_set_allocate_info, &slot.descriptor_set_) != VK_SUCCESS
+           || vkCreateFence(device_, &fence_create_info, nullptr, &slot.fence_) != VK_SUCCESS) {
+            return false;
+        }
+    }
+
+    vkGetDeviceQueue(device_, queue_family_index_, 0, &queue_);
+
+    return true;
+}
+
+void vulkan_raytracer::create_query_pool() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device_, &properties);
+
+    u32 queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device_, &queue_family_count, nullptr);
+
+    std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device_, &queue_family_count, queue_families.data());
+
+    const u32 valid_bits = (queue_family_index_ < queue_family_count)
+        ? queue_families[queue_family_index_].timestampValidBits
+        : 0;
+
+    // Profiling is optional, frames are rendered the same without it
+    if(valid_bits == 0 || properties.limits.timestampPeriod <= 0.0f) {
+        return;
+    }
+
+    const VkQueryPoolCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = static_cast<u32>(slots_.size()) * timestamps_per_frame
+    };
+
+    if(vkCreateQueryPool(device_, &create_info, nullptr, &query_pool_) != VK_SUCCESS) {
+        query_pool_ = VK_NULL_HANDLE;
+        return;
+    }
+
+    timestamp_period_ns_ = properties.limits.timestampPeriod;
+    timestamp_mask_ = (valid_bits >= 64) ? ~0ull : ((1ull << valid_bits) - 1);
+}
+
+bool vulkan_raytracer::upload_scene(const ae::scene &scene) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device_, &properties);
+
+    const VkDeviceSize alignment = ae::max(properties.limits.minStorageBufferOffsetAlignment, static_cast<VkDeviceSize>(16));
+
+    // All arrays share one buffer. Empty ones still take up an element, descriptors can't have a zero range.
+    const std::span<const std::byte> arrays[scene_binding_count] = {
+        std::as_bytes(scene.primitives()),
+        std::as_bytes(scene.nodes()),
+        std::as_bytes(scene.materials())
+    };
+
+    VkDescriptorBufferInfo buffer_infos[scene_binding_count];
+    VkDeviceSize size = 0;
+
+    for(u32 i = 0; i < scene_binding_count; i++) {
+        size = (size + alignment - 1) & ~(alignment - 1);
+
+        buffer_infos[i] = {
+            .buffer = VK_NULL_HANDLE,
+            .offset = size,
+            .range = ae::max(static_cast<VkDeviceSize>(arrays[i].size()), static_cast<VkDeviceSize>(sizeof(ae::scene::bvh_node)))
+        };
+
+        size += buffer_infos[i].range;
+    }
+
+    vulkan_handle<VkBuffer, VkDevice, decltype(vkDestroyBuffer)>
+        staging_buffer(create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT), device_, vkDestroyBuffer);
+    vulkan_handle<VkBuffer, VkDevice, decltype(vkDestroyBuffer)>
+        scene_buffer(create_buffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT),
+                     device_,
+                     vkDestroyBuffer);
+
+    if(!staging_buffer || !scene_buffer) {
+        return false;
+    }
+
+    VkMemoryRequirements staging_requirements;
+    vkGetBufferMemoryRequirements(device_, *staging_buffer, &staging_requirements);
+
+    VkMemoryRequirements scene_requirements;
+    vkGetBufferMemoryRequirements(device_, *scene_buffer, &scene_requirements);
+
+    u32 memory_flags;
+
+    vulkan_handle<VkDeviceMemory, VkDevice, decltype(vkFreeMemory)>
+        staging_memory(allocate_memory(staging_requirements,
+                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                       memory_flags),
+                       device_,
+                       vkFreeMemory);
+    vulkan_handle<VkDeviceMemory, VkDevice, decltype(vkFreeMemory)>
+        scene_memory(allocate_memory(scene_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, memory_flags),
+                     device_,
+                     vkFreeMemory);
+
+    void *mapping = nullptr;
+
+    if(!staging_memory
+       || !scene_memory
+       || (vkBindBufferMemory(device_, *staging_buffer, *staging_memory, 0) != VK_SUCCESS)
+       || (vkBindBufferMemory(device_, *scene_buffer, *scene_memory, 0) != VK_SUCCESS)
+       || (vkMapMemory(device_, *staging_memory, 0, VK_WHOLE_SIZE, 0, &mapping) != VK_SUCCESS)) {
+        return false;
+    }
+
+    std::memset(mapping, 0, size);
+
+    for(u32 i = 0; i < scene_binding_count; i++) {
+        std::memcpy(static_cast<u8 *>(mapping) + buffer_infos[i].offset, arrays[i].data(), arrays[i].size());
+        buffer_infos[i].buffer = *scene_buffer;
+    }
+
+    vkUnmapMemory(device_, *staging_memory);
+
+    // One-off transfer, the scene stays on the device for every following frame
+    const VkCommandBufferAllocateInfo allocate_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = command_pool_,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1
+    };
+
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+
+    if(vkAllocateCommandBuffers(device_, &allocate_info, &command_buffer) != VK_SUCCESS) {
+        return false;
+    }
+
+    const VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+
+    const VkBufferCopy buffer_copy = {
+        .srcOffset = 0,
+        .dstOffset = 0,
+        .size = size
+    };
+
+    vkCmdCopyBuffer(command_buffer, *staging_buffer, *scene_buffer, 1, &buffer_copy);
+
+    const VkBufferMemoryBarrier scene_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = *scene_buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE
+    };
+
+    vkCmdPipelineBarrier(command_buffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         1,
+                         &scene_barrier,
+                         0,
+                         nullptr);
+
+    vkEndCommandBuffer(command_buffer);
+
+    const VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffer
+    };
+
+    // The staging buffer has to stay alive until the copy is done
+    const bool uploaded = vkQueueSubmit(queue_, 1, &submit_info, VK_NULL_HANDLE) == VK_SUCCESS
+        && vkQueueWaitIdle(queue_) == VK_SUCCESS;
+
+    vkFreeCommandBuffers(device_, command_pool_, 1, &command_buffer);
+
+    if(!uploaded) {
+        return false;
+    }
+
+    scene_buffer_ = scene_buffer.release();
+    scene_memory_ = scene_memory.release();
+
+    for(frame_slot &slot : slots_) {
+        VkWriteDescriptorSet write_descriptor_sets[scene_binding_count];
+
+        for(u32 i = 0; i < scene_binding_count; i++) {
+            write_descriptor_sets[i] = {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = slot.descriptor_set_,
+                .dstBinding = i + 1,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &buffer_infos[i]
+            };
+        }
+
+        vkUpdateDescriptorSets(device_, scene_binding_count, write_descriptor_sets, 0, nullptr);
+    }
+
+    return true;
 }
 
-VkImage vulkan_raytracer::create_image(u32 width, u32 height) const {
+VkImage vulkan_raytracer::create_image(u32 width, u32 height, u32 layers) const {
     const VkImageCreateInfo image_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType = VK_IMAGE_TYPE_2D,
@@ -592,10 +1910,10 @@ VkImage vulkan_raytracer::create_image(u32 width, u32 height) const {
             .depth = 1
         },
         .mipLevels = 1,
-        .arrayLayers = 1,
+        .arrayLayers = layers,
         .samples = VK_SAMPLE_COUNT_1_BIT,
-        .tiling = VK_IMAGE_TILING_LINEAR,
-        .usage = VK_IMAGE_USAGE_STORAGE_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
         .queueFamilyIndexCount = 1,
         .pQueueFamilyIndices = &queue_family_index_,
@@ -612,13 +1930,48 @@ VkImage vulkan_raytracer::create_image(u32 width, u32 height) const {
     return (result == VK_SUCCESS) ? image : VK_NULL_HANDLE;
 }
 
-VkImageView vulkan_raytracer::create_image_view(VkImage image) const {
+u32 vulkan_raytracer::find_memory_type(u32 type_bits, u32 required_flags) const {
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device_, &memory_properties);
+
+    for(u32 i = 0; i < memory_properties.memoryTypeCount; i++) {
+        if((type_bits & (1 << i))
+           && ((memory_properties.memoryTypes[i].propertyFlags & required_flags) == required_flags)) {
+            return i;
+        }
+    }
+
+    return static_cast<u32>(-1);
+}
+
+VkBuffer vulkan_raytracer::create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, const void *next) const {
+    const VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = next,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices = &queue_family_index_
+    };
+
+    VkBuffer buffer;
+
+    const VkResult result = vkCreateBuffer(device_,
+                                           &buffer_create_info,
+                                           nullptr,
+                                           &buffer);
+
+    return (result == VK_SUCCESS) ? buffer : VK_NULL_HANDLE;
+}
+
+VkImageView vulkan_raytracer::create_image_view(VkImage image, u32 layers) const {
     assert(image != VK_NULL_HANDLE);
 
     const VkImageViewCreateInfo image_view_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
         .image = image,
-        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
         .format = vulkan_raytracer::image_format,
         .components = {
             .r = VK_COMPONENT_SWIZZLE_IDENTITY,
@@ -631,7 +1984,7 @@ VkImageView vulkan_raytracer::create_image_view(VkImage image) const {
             .baseMipLevel = 0,
             .levelCount = 1,
             .baseArrayLayer = 0,
-            .layerCount = 1
+            .layerCount = layers
         }
     };
 
@@ -673,24 +2026,62 @@ bool vulkan_raytracer::load_functions() {
 
 #define AE_VULKAN_GET_PROC_ADDR(item) vkGetInstanceProcAddr(VK_NULL_HANDLE, #item)
     AE_VULKAN_GLOBAL_FUNCS
+
+    u64 phase_start = ae::system_time_ns();
+
     if(!create_instance()) {
         return false;
     }
+
+    ae::stats_record("vulkan setup", "create_instance", ae::stats_elapsed_ms(phase_start));
 #undef AE_VULKAN_GET_PROC_ADDR
 
+#undef X
+
+    // Instance and device level functions belong to the instance and device they were queried from, a raytracer
+    // created after an earlier one was destroyed must not keep calling into the old ones
+#define X(item) \
+    if(item = reinterpret_cast<PFN_##item>(AE_VULKAN_GET_PROC_ADDR(item)); !item) { \
+        return false; \
+    }
+
 #define AE_VULKAN_GET_PROC_ADDR(item) vkGetInstanceProcAddr(instance_, #item)
     AE_VULKAN_INSTANCE_FUNCS
+#undef X
+
+#define X(item) item = reinterpret_cast<PFN_##item>(AE_VULKAN_GET_PROC_ADDR(item));
+    AE_VULKAN_OPTIONAL_INSTANCE_FUNCS
+
+    phase_start = ae::system_time_ns();
+
     if(!create_device()) {
         return false;
     }
+
+    ae::stats_record("vulkan setup", "create_device", ae::stats_elapsed_ms(phase_start));
 #undef AE_VULKAN_GET_PROC_ADDR
 
 #define AE_VULKAN_GET_PROC_ADDR(item) vkGetDeviceProcAddr(device_, #item)
+    AE_VULKAN_OPTIONAL_DEVICE_FUNCS
+#undef X
+
+#define X(item) \
+    if(item = reinterpret_cast<PFN_##item>(AE_VULKAN_GET_PROC_ADDR(item)); !item) { \
+        return false; \
+    }
+
     AE_VULKAN_DEVICE_FUNCS
 #undef AE_VULKAN_GET_PROC_ADDR
 
 #undef X
 
+    // Only one device is alive at a time, the hook forwards to the functions of the current one
+    untracked_allocate_memory = vkAllocateMemory;
+    untracked_free_memory = vkFreeMemory;
+
+    vkAllocateMemory = tracked_allocate_memory;
+    vkFreeMemory = tracked_free_memory;
+
     return true;
 }
 
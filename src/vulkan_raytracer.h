@@ -2,9 +2,14 @@
 
 #include "raytracer.h"
 
+#include <span>
+#include <string>
+#include <vector>
 #include <vulkan/vulkan.h>
 
 namespace ae {
+    class scene;
+
     class vulkan_raytracer final : public raytracer {
     public:
         static constexpr u32 req_major_version = 1;
@@ -17,31 +22,158 @@ namespace ae {
         ~vulkan_raytracer() override;
 
         bool setup() override;
-        void trace() override;
+        bool trace() override;
+
+        // Pipelined rendering. Up to frames_in_flight() frames can be queued on the device before the
+        // oldest one has to be collected, so the device keeps working while finished frames are read back
+        // and written out. Frames are collected in submission order. trace() is a submit() and a collect().
+        // destination is where the frame will be collected to. If it lies within an imported destination,
+        // the frame is copied there directly and collect() has nothing left to do.
+        bool submit(u32 *destination = nullptr);
+        bool collect(u32 *buffer);
+
+        // Imports size bytes at destination as host memory if the device can, so frames submitted into it skip the
+        // copy in collect(). It has to stay valid until it is released or the raytracer is destroyed, and can only
+        // be released once the frames submitted into it are collected. The framebuffer is imported by setup().
+        bool import_destination(u32 *destination, size_t size);
+        void release_destination(const u32 *destination);
+
+        // Renders and reads back only the given band, which has to lie within get_region()
+        bool submit(u32 *destination, const ae::raytracer::region &band);
+
+        // Camera of one view in a batch
+        struct view {
+            ae::vec4f camera_pos_;
+            ae::vec4f scene_offset_;
+        };
+
+        static constexpr u32 max_batch_views = 16;
+
+        // Batched rendering. Up to max_batch_views views of the region are traced by a single dispatch into the
+        // layers of an array image and read back with a single copy, so the per-view cost is only their pixels.
+        // collect_views() takes one buffer per submitted view, in the same order.
+        bool submit_views(std::span<const view> views);
+        bool collect_views(std::span<u32 *const> buffers);
+
+        u32 frames_in_flight() const { return static_cast<u32>(slots_.size()); }
+        u32 pending_frames() const { return pending_frames_; }
 
     private:
         static constexpr VkFormat image_format = VK_FORMAT_B8G8R8A8_UNORM;
+        static constexpr u32 max_frames_in_flight = 8;
+        static constexpr u32 scene_binding_count = 3; // Primitives, BVH nodes and materials
+        static constexpr u32 view_binding = 4;
+        static constexpr u32 timestamps_per_frame = 3; // Start, dispatch done, readback copies done
+
+        // Everything that depends on the resolution. Kept alive across frames
+        // and only rebuilt when the resolution changes or a batch needs more views.
+        // The shader writes into a device local array image with optimal tiling, one layer per view, which then
+        // gets copied into a host visible readback buffer that only holds the region of each layer.
+        struct frame_resources {
+            VkImage image_ = VK_NULL_HANDLE;
+            VkDeviceMemory image_memory_ = VK_NULL_HANDLE;
+            VkImageView image_view_ = VK_NULL_HANDLE;
+            VkBuffer readback_buffer_ = VK_NULL_HANDLE;
+            VkDeviceMemory readback_memory_ = VK_NULL_HANDLE;
+            VkBuffer view_buffer_ = VK_NULL_HANDLE;
+            VkDeviceMemory view_memory_ = VK_NULL_HANDLE;
+            void *mapping_ = nullptr;
+            view *views_ = nullptr; // Mapped view buffer, host coherent
+            u32 width_ = 0;
+            u32 height_ = 0;
+            u32 layers_ = 0;
+            bool readback_coherent_ = false;
+        };
+
+        // Destination memory imported with VK_EXT_external_memory_host, kept for every frame submitted into it
+        struct imported_destination {
+            VkBuffer buffer_ = VK_NULL_HANDLE;
+            VkDeviceMemory memory_ = VK_NULL_HANDLE;
+            VkDeviceSize offset_ = 0; // Of the destination within the imported range
+            VkDeviceSize size_ = 0; // Of the destination
+            const u32 *target_ = nullptr;
+        };
+
+        // One entry of the ring of frames in flight
+        struct frame_slot {
+            VkCommandBuffer command_buffer_ = VK_NULL_HANDLE;
+            VkDescriptorSet descriptor_set_ = VK_NULL_HANDLE;
+            VkFence fence_ = VK_NULL_HANDLE;
+            frame_resources resources_;
+            const u32 *written_ = nullptr; // Destination the device copied the frame into, if any
+            VkDeviceSize readback_size_ = 0; // Of the submitted band, in every view
+            u32 view_count_ = 0;
+        };
+
+        // Compiled pipeline for one workgroup size, built on first use
+        struct pipeline_variant {
+            u32 group_width_ = 0;
+            u32 group_height_ = 0;
+            VkShaderModule shader_module_ = VK_NULL_HANDLE;
+            VkPipeline pipeline_ = VK_NULL_HANDLE;
+        };
 
         bool create_instance();
         bool create_device();
         bool create_pipeline();
+        void select_workgroup_size();
+        const pipeline_variant * find_pipeline(u32 group_width, u32 group_height);
         bool create_command_handles();
-        [[nodiscard]] VkImage create_image(u32 width, u32 height) const;
-        [[nodiscard]] VkImageView create_image_view(VkImage image) const;
+        void create_query_pool();
+        bool submit(std::span<const view> views, u32 *destination, const ae::raytracer::region &band);
+        bool upload_scene(const ae::scene &scene);
+        bool create_frame_resources(frame_slot &slot, u32 width, u32 height, u32 layers);
+        void destroy_frame_resources(frame_slot &slot);
+        const imported_destination * find_import(const u32 *destination, VkDeviceSize size) const;
+        void release_import(imported_destination &import);
+        [[nodiscard]] VkImage create_image(u32 width, u32 height, u32 layers) const;
+        [[nodiscard]] VkImageView create_image_view(VkImage image, u32 layers) const;
+        [[nodiscard]] VkBuffer create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, const void *next = nullptr) const;
+        [[nodiscard]] u32 find_memory_type(u32 type_bits, u32 required_flags) const;
+
+        // Falls back to fallback_flags if no memory type has all of preferred_flags, property_flags receives the ones used
+        [[nodiscard]] VkDeviceMemory allocate_memory(const VkMemoryRequirements &requirements,
+                                                     u32 preferred_flags,
+                                                     u32 fallback_flags,
+                                                     u32 &property_flags) const;
         bool load_functions();
 
+        // The driver's pipeline cache persisted in the cache directory (or --cache-dir)
+        void create_pipeline_cache(u64 shader_hash);
+        void save_pipeline_cache();
+
         static void * lib_;
         VkInstance instance_ = VK_NULL_HANDLE;
         VkPhysicalDevice physical_device_ = VK_NULL_HANDLE;
         VkDevice device_ = VK_NULL_HANDLE;
-        VkShaderModule compute_shader_module_ = VK_NULL_HANDLE;
         VkDescriptorSetLayout descriptor_set_layout_ = VK_NULL_HANDLE;
         VkDescriptorPool descriptor_pool_ = VK_NULL_HANDLE;
         VkPipelineLayout pipeline_layout_ = VK_NULL_HANDLE;
-        VkPipeline pipeline_ = VK_NULL_HANDLE;
+        VkPipelineCache pipeline_cache_ = VK_NULL_HANDLE;
         VkCommandPool command_pool_ = VK_NULL_HANDLE;
-        VkCommandBuffer command_buffer_ = VK_NULL_HANDLE;
+        VkQueue queue_ = VK_NULL_HANDLE;
+        VkQueryPool query_pool_ = VK_NULL_HANDLE; // Null if the queue doesn't support timestamps
+        VkBuffer scene_buffer_ = VK_NULL_HANDLE;
+        VkDeviceMemory scene_memory_ = VK_NULL_HANDLE;
+        std::vector<frame_slot> slots_;
+        std::vector<imported_destination> imports_;
+        std::vector<pipeline_variant> pipelines_;
+        std::vector<u32> shader_code_; // Unspecialized SPIR-V
+
+        u32 group_width_ = 16;
+        u32 group_height_ = 16;
+        u32 next_slot_ = 0;
+        u32 pending_frames_ = 0;
+
+        std::string pipeline_cache_path_;
+        size_t pipeline_cache_loaded_size_ = 0;
+        u64 shader_hash_ = 0;
+
+        f64 timestamp_period_ns_ = 0.0;
+        u64 timestamp_mask_ = 0;
 
+        VkDeviceSize host_pointer_alignment_ = 0; // 0 if host memory can't be imported
+        u32 instance_api_version_ = 0;
         u32 queue_family_index_ = static_cast<u32>(-1);
     };
 }